@@ -0,0 +1,48 @@
+#include "inc/task_api.h"
+
+using namespace task_api;
+
+constexpr std::chrono::seconds ChatLoader::retryInterval;
+
+ChatLoader::ChatLoader(ClientWrapper* client_ptr, std::int32_t account)
+  : TdTask(client_ptr, account) {}
+
+StepResult ChatLoader::step() {
+  if (!started_) {
+    started_ = true;
+    load();
+  }
+  process_responses();
+  if (loaded_ || terminate_) {
+    destroy_coroutines();
+    return StepResult::kDone;
+  }
+  wake_at_ = next_timer();
+  return StepResult::kPark;
+}
+
+Coroutine ChatLoader::load() {
+  while (!terminate_) {
+    auto result = co_await query<td_api::ok>(
+      td_api::make_object<td_api::loadChats>(nullptr, pageSize));
+    if (result.ok()) {
+      ++pages_;
+      continue;
+    }
+    // 404: every chat of the list is loaded
+    if (result.error_code() == 404) {
+      break;
+    }
+    std::cout << "Failed to load chats of [" << client_ptr_->database_directory(account_)
+      << "] (will retry later): " << result.error() << std::endl;
+    co_await sleep_until(std::chrono::steady_clock::now() + retryInterval);
+  }
+  loaded_ = true;
+}
+
+void ChatLoader::print_status() {
+  std::cout << "Chat loader status: " << std::endl;
+  std::cout << "  account: " << client_ptr_->database_directory(account_) << std::endl;
+  std::cout << "  pages loaded: " << pages_ << std::endl;
+  std::cout << "  done: " << loaded_ << std::endl;
+}
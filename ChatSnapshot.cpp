@@ -0,0 +1,189 @@
+#include "inc/chat_snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using namespace task_api;
+
+namespace {
+const char snapshotMagic[8] = {'T', 'D', 'C', 'H', 'A', 'T', 'S', '1'};
+const std::size_t recordHeader = sizeof(int64_t) + sizeof(uint32_t);
+
+uint64_t title_hash(const char* p, std::size_t n) {
+  // FNV-1a
+  uint64_t h = 14695981039346656037ull;
+  for (std::size_t i = 0; i < n; ++i) {
+    h = (h ^ static_cast<unsigned char>(p[i])) * 1099511628211ull;
+  }
+  return h;
+}
+
+// calls f(chat id, title, length, record offset) for every complete record
+// and returns the length of the valid prefix
+template <class F>
+std::size_t walk(const char* data, std::size_t size, F f) {
+  if (size < sizeof(snapshotMagic) || std::memcmp(data, snapshotMagic, sizeof(snapshotMagic)) != 0) {
+    return 0;
+  }
+  std::size_t pos = sizeof(snapshotMagic);
+  while (size - pos >= recordHeader) {
+    int64_t chat_id;
+    uint32_t length;
+    std::memcpy(&chat_id, data + pos, sizeof(chat_id));
+    std::memcpy(&length, data + pos + sizeof(chat_id), sizeof(length));
+    if (size - pos - recordHeader < length) {
+      break;
+    }
+    f(chat_id, data + pos + recordHeader, length, pos);
+    pos += recordHeader + length;
+  }
+  return pos;
+}
+
+// maps the whole file read only, null when it is empty or can't be mapped
+const char* map_file(int fd, std::size_t& size) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    return nullptr;
+  }
+  size = static_cast<std::size_t>(st.st_size);
+  void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  return p == MAP_FAILED ? nullptr : static_cast<const char*>(p);
+}
+
+bool write_all(int fd, const std::string& buf) {
+  const char* p = buf.data();
+  std::size_t left = buf.size();
+  while (left > 0) {
+    ssize_t n = ::write(fd, p, left);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    left -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+void encode(std::string& buf, int64_t chat_id, const char* title, uint32_t length) {
+  buf.append(reinterpret_cast<const char*>(&chat_id), sizeof(chat_id));
+  buf.append(reinterpret_cast<const char*>(&length), sizeof(length));
+  buf.append(title, length);
+}
+}  // namespace
+
+ChatSnapshot::ChatSnapshot(const std::string& path) : path_(path) {
+  load();
+}
+
+ChatSnapshot::~ChatSnapshot() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void ChatSnapshot::load() {
+  fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd_ < 0) {
+    std::cout << "Failed to open [" << path_ << "], chat titles are not kept" << std::endl;
+    return;
+  }
+  std::size_t size = 0;
+  const char* data = map_file(fd_, size);
+  std::unordered_map<int64_t, std::size_t> latest;
+  std::size_t valid = 0;
+  if (data != nullptr) {
+    valid = walk(data, size, [this, &latest](int64_t chat_id, const char* title, uint32_t length, std::size_t pos) {
+      titles_[chat_id] = title_hash(title, length);
+      latest[chat_id] = pos;
+      ++records_;
+    });
+  }
+
+  if (valid == 0) {
+    // new, or not a snapshot
+    titles_.clear();
+    records_ = 0;
+    std::string magic(snapshotMagic, sizeof(snapshotMagic));
+    if (::ftruncate(fd_, 0) != 0 || !write_all(fd_, magic)) {
+      std::cout << "Failed to initialize [" << path_ << "]" << std::endl;
+    }
+  }
+  else if (records_ > titles_.size() * 2 + compactSlack) {
+    compact(data, latest);
+  }
+  else if (valid < size && ::ftruncate(fd_, valid) != 0) {
+    std::cout << "Failed to drop the torn end of [" << path_ << "]" << std::endl;
+  }
+  if (data != nullptr) {
+    ::munmap(const_cast<char*>(data), size);
+  }
+  ::lseek(fd_, 0, SEEK_END);
+}
+
+void ChatSnapshot::compact(const char* data, const std::unordered_map<int64_t, std::size_t>& latest) {
+  std::string buf(snapshotMagic, sizeof(snapshotMagic));
+  for (auto& l : latest) {
+    uint32_t length;
+    std::memcpy(&length, data + l.second + sizeof(int64_t), sizeof(length));
+    encode(buf, l.first, data + l.second + recordHeader, length);
+  }
+  std::string tmp = path_ + ".tmp";
+  int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || !write_all(fd, buf) || std::rename(tmp.c_str(), path_.c_str()) != 0) {
+    std::cout << "Failed to compact [" << path_ << "]" << std::endl;
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    return;
+  }
+  ::close(fd_);
+  fd_ = fd;
+  records_ = latest.size();
+}
+
+void ChatSnapshot::for_each(const std::function<void(int64_t, const std::string&)>& f) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (fd_ < 0) {
+    return;
+  }
+  std::size_t size = 0;
+  const char* data = map_file(fd_, size);
+  if (data == nullptr) {
+    return;
+  }
+  std::string title;
+  walk(data, size, [&f, &title](int64_t chat_id, const char* p, uint32_t length, std::size_t) {
+    title.assign(p, length);
+    f(chat_id, title);
+  });
+  ::munmap(const_cast<char*>(data), size);
+}
+
+void ChatSnapshot::put(int64_t chat_id, const std::string& title) {
+  uint64_t h = title_hash(title.data(), title.size());
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = titles_.find(chat_id);
+  if (fd_ < 0 || (it != titles_.end() && it->second == h)) {
+    return;
+  }
+  std::string buf;
+  encode(buf, chat_id, title.data(), static_cast<uint32_t>(title.size()));
+  if (!write_all(fd_, buf)) {
+    std::cout << "Failed to write [" << path_ << "]" << std::endl;
+    return;
+  }
+  titles_[chat_id] = h;
+  ++records_;
+}
+
+std::size_t ChatSnapshot::size() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return titles_.size();
+}
@@ -1,197 +1,340 @@
 #include "inc/task_api.h"
 
+#include <algorithm>
+
 using namespace task_api;
 
-ClientWrapper::ClientWrapper() {
+namespace {
+// "getChatHistory" of "getChatHistory {...}"
+std::string function_name(const td_api::Function& f) {
+  std::string text = to_string(f);
+  return text.substr(0, text.find_first_of(" {\n"));
+}
+}  // namespace
+
+ClientWrapper::ClientWrapper(std::unique_ptr<Transport> transport,
+  const std::vector<std::string>& database_directories)
+  : transport_(std::move(transport)) {
   td::ClientManager::execute(
     td_api::make_object<td_api::setLogVerbosityLevel>(1));
-  client_manager_ = std::make_unique<td::ClientManager>();
-  client_id_ = client_manager_->create_client_id();
-  send_authentication_query(td_api::make_object<td_api::getOption>("version"),
-    {});
+  for (auto& directory : database_directories) {
+    if (accounts_.size() == maxAccounts) {
+      std::cout << "Only " << maxAccounts << " accounts are supported, ignoring ["
+        << directory << "]" << std::endl;
+      break;
+    }
+    Account account;
+    account.database_directory = directory;
+    account.client_id = transport_->create_client_id();
+    account_by_client_[account.client_id] = static_cast<std::int32_t>(accounts_.size());
+    accounts_.push_back(std::move(account));
+  }
+  for (std::int32_t account = 0; account < accounts(); ++account) {
+    send_authentication_query(account,
+      td_api::make_object<td_api::getOption>("version"), {});
+  }
 }
 
 std::uint64_t ClientWrapper::next_query_id() {
-  std::lock_guard<std::mutex> lock(query_id_lock_);
-  return ++current_query_id_;
+  return current_query_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+bool ClientWrapper::need_restart() const {
+  for (auto& account : accounts_) {
+    if (account.closed) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ClientWrapper::authenticated() const {
+  for (auto& account : accounts_) {
+    if (!account.authorized) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<std::int32_t> ClientWrapper::accounts_with_chat(std::int64_t chat_id) {
+  std::uint64_t mask = 0;
+  {
+    std::lock_guard<std::mutex> lock(chats_lock_);
+    auto it = chat_accounts_.find(chat_id);
+    if (it != chat_accounts_.end()) {
+      mask = it->second;
+    }
+  }
+  std::vector<std::int32_t> result;
+  for (std::int32_t account = 0; account < accounts(); ++account) {
+    if (mask & (std::uint64_t(1) << account)) {
+      result.push_back(account);
+    }
+  }
+  return result;
 }
 
 void ClientWrapper::send_query(std::uint64_t query_id,
   td_api::object_ptr<td_api::Function> f,
-  TdTask* task) {
-  std::lock_guard<std::mutex> lock(response_registry_lock_);
-  response_registry_.emplace(query_id, task);
-  client_manager_->send(client_id_, query_id, std::move(f));
+  TdTask* task, std::int32_t account) {
+  Metrics::instance().query_sent(f->get_id(), [&f] { return function_name(*f); });
+  response_registry_.publish(query_id, task);
+  transport_->send(accounts_[account].client_id, query_id, std::move(f));
+}
+
+void ClientWrapper::subscribe_update(std::int32_t type_id, TdTask* task, std::int32_t account) {
+  std::lock_guard<std::mutex> lock(update_registry_lock_);
+  auto& tasks = update_registry_[{account, type_id}];
+  if (std::find(tasks.begin(), tasks.end(), task) == tasks.end()) {
+    tasks.push_back(task);
+  }
+}
+
+void ClientWrapper::unsubscribe_update(std::int32_t type_id, TdTask* task, std::int32_t account) {
+  std::lock_guard<std::mutex> lock(update_registry_lock_);
+  auto it = update_registry_.find({account, type_id});
+  if (it != update_registry_.end()) {
+    it->second.erase(std::remove(it->second.begin(), it->second.end(), task), it->second.end());
+  }
+}
+
+void ClientWrapper::route_file(std::int32_t file_id, TdTask* task, std::int32_t account) {
+  std::lock_guard<std::mutex> lock(update_registry_lock_);
+  file_routes_[file_key(account, file_id)] = task;
 }
 
-void ClientWrapper::subscribe_update(std::int32_t type_id, TdTask* task) {
+void ClientWrapper::unroute_file(std::int32_t file_id, std::int32_t account) {
   std::lock_guard<std::mutex> lock(update_registry_lock_);
-  update_registry_.erase(type_id);
-  update_registry_.emplace(type_id, task);
+  file_routes_.erase(file_key(account, file_id));
+}
+
+void ClientWrapper::print_status() {
+  std::cout << "Client status: " << std::endl;
+  for (std::int32_t account = 0; account < accounts(); ++account) {
+    std::cout << "  [" << accounts_[account].database_directory << "] client "
+      << accounts_[account].client_id << ", authorized: " << accounts_[account].authorized
+      << std::endl;
+  }
+  std::size_t routes = 0;
+  {
+    std::lock_guard<std::mutex> lock(update_registry_lock_);
+    routes = file_routes_.size();
+  }
+  std::size_t chats = 0;
+  {
+    std::lock_guard<std::mutex> lock(chats_lock_);
+    chats = chat_accounts_.size();
+  }
+  std::cout << "  known chats: " << chats << ", routed downloads: " << routes << std::endl;
 }
 
 void ClientWrapper::run() {
   while (!terminate_) {
-    receive_and_dispatch();
-    if (are_authorized_) {
-      std::this_thread::sleep_for(std::chrono::seconds(3));
-    }
+    receive_and_dispatch(receiveTimeout);
   }
 }
 
-void ClientWrapper::receive_and_dispatch() {
-  auto response = client_manager_->receive(0);
+void ClientWrapper::terminate() {
+  Task::terminate();
+  // receive() can't be interrupted, the response to a cheap query wakes it up
+  Metrics::instance().add(Metrics::kQueriesSent);
+  transport_->send(accounts_[0].client_id, next_query_id(),
+    td_api::make_object<td_api::getOption>("version"));
+}
+
+void ClientWrapper::receive_and_dispatch(double timeout) {
+  auto response = transport_->receive(timeout);
   while (response.object) {
-    if (response.request_id == 0) {
-      std::lock_guard<std::mutex> lock(update_registry_lock_);
-      auto iterator = update_registry_.find(response.object->get_id());
-      if (iterator != update_registry_.end()) {
-        iterator->second->accept_response(std::move(response));
+    dispatch(std::move(response));
+    response = transport_->receive(0);
+  }
+}
+
+void ClientWrapper::dispatch(td::ClientManager::Response response) {
+  if (response.request_id == 0) {
+    Metrics::instance().add(Metrics::kUpdates);
+    auto owner = account_by_client_.find(response.client_id);
+    if (owner == account_by_client_.end()) {
+      return;
+    }
+    std::int32_t account = owner->second;
+    if (response.object->get_id() == td_api::updateNewChat::ID) {
+      auto& update = static_cast<td_api::updateNewChat&>(*response.object);
+      std::lock_guard<std::mutex> lock(chats_lock_);
+      chat_accounts_[update.chat_->id_] |= std::uint64_t(1) << account;
+    }
+    std::lock_guard<std::mutex> lock(update_registry_lock_);
+    if (response.object->get_id() == td_api::updateFile::ID) {
+      auto& file = static_cast<td_api::updateFile&>(*response.object).file_;
+      auto route = file_routes_.find(file_key(account, file->id_));
+      if (route != file_routes_.end()) {
+        route->second->accept_response(std::move(response));
+        return;
       }
-      else {
-        process_update(std::move(response.object));
+    }
+    auto iterator = update_registry_.find({account, response.object->get_id()});
+    if (iterator != update_registry_.end() && !iterator->second.empty()) {
+      auto& tasks = iterator->second;
+      for (std::size_t i = 0; i + 1 < tasks.size(); ++i) {
+        td::ClientManager::Response copy;
+        copy.client_id = response.client_id;
+        copy.request_id = 0;
+        copy.object = copy_object(*response.object);
+        if (!copy.object) {
+          // the codec doesn't cover the type, only the last subscriber gets it
+          if (uncopied_updates_.insert(response.object->get_id()).second) {
+            std::cout << "Updates of type [" << response.object->get_id()
+              << "] can't be copied, they go to one subscriber only" << std::endl;
+          }
+          continue;
+        }
+        tasks[i]->accept_response(std::move(copy));
       }
+      tasks.back()->accept_response(std::move(response));
     }
     else {
-      std::lock_guard<std::mutex> lock(response_registry_lock_);
-      auto iterator = response_registry_.find(response.request_id);
-      if (iterator != response_registry_.end()) {
-        iterator->second->accept_response(std::move(response));
-        response_registry_.erase(iterator);
-      }
-      else {
-        auto it2 = handlers_.find(response.request_id);
-        if (it2 != handlers_.end()) {
-          it2->second(std::move(response.object));
-          handlers_.erase(it2);
-        }
+      process_update(account, std::move(response.object));
+    }
+  }
+  else {
+    Metrics::instance().add(Metrics::kResponses);
+    TdTask* task = response_registry_.retire(response.request_id);
+    if (task != nullptr) {
+      task->accept_response(std::move(response));
+    }
+    else {
+      auto it2 = handlers_.find(response.request_id);
+      if (it2 != handlers_.end()) {
+        it2->second(std::move(response.object));
+        handlers_.erase(it2);
       }
     }
-
-    response = client_manager_->receive(0);
   }
 }
 
-void ClientWrapper::process_update(Object update) {
+void ClientWrapper::process_update(std::int32_t account, Object update) {
   //std::cout << "processing update..." << update->get_id() << std::endl;
   td_api::downcast_call(
     *update,
     overloaded(
-      [this](td_api::updateAuthorizationState& update_authorization_state) {
-        authorization_state_ =
+      [this, account](td_api::updateAuthorizationState& update_authorization_state) {
+        accounts_[account].authorization_state =
           std::move(update_authorization_state.authorization_state_);
-        on_authorization_state_update();
+        on_authorization_state_update(account);
       },
       [](auto& update) {}));
 }
 
-auto ClientWrapper::create_authentication_query_handler() {
-  return [this, id = authentication_query_id_](Object object) {
-    if (id == authentication_query_id_) {
-      check_authentication_error(std::move(object));
+auto ClientWrapper::create_authentication_query_handler(std::int32_t account) {
+  return [this, account, id = accounts_[account].authentication_query_id](Object object) {
+    if (id == accounts_[account].authentication_query_id) {
+      check_authentication_error(account, std::move(object));
     }
   };
 }
 
-void ClientWrapper::on_authorization_state_update() {
+void ClientWrapper::on_authorization_state_update(std::int32_t account) {
   //std::cout << "on authorization state update" << std::endl;
-  authentication_query_id_++;
+  accounts_[account].authentication_query_id++;
+  // prompts name the account they are for
+  std::string name = "[" + accounts_[account].database_directory + "] ";
   td_api::downcast_call(
-    *authorization_state_,
+    *accounts_[account].authorization_state,
     overloaded(
-      [this](td_api::authorizationStateReady&) {
-        are_authorized_ = true;
-        std::cout << "Got authorization" << std::endl;
+      [this, account, &name](td_api::authorizationStateReady&) {
+        accounts_[account].authorized = true;
+        std::cout << name << "Got authorization" << std::endl;
       },
-      [this](td_api::authorizationStateLoggingOut&) {
-        are_authorized_ = false;
-        std::cout << "Logging out" << std::endl;
+      [this, account, &name](td_api::authorizationStateLoggingOut&) {
+        accounts_[account].authorized = false;
+        std::cout << name << "Logging out" << std::endl;
       },
-        [this](td_api::authorizationStateClosing&) {
-        std::cout << "Closing" << std::endl;
+        [this, account, &name](td_api::authorizationStateClosing&) {
+        std::cout << name << "Closing" << std::endl;
       },
-        [this](td_api::authorizationStateClosed&) {
-        are_authorized_ = false;
-        need_restart_ = true;
-        std::cout << "Terminated" << std::endl;
+        [this, account, &name](td_api::authorizationStateClosed&) {
+        accounts_[account].authorized = false;
+        accounts_[account].closed = true;
+        std::cout << name << "Terminated" << std::endl;
       },
-        [this](td_api::authorizationStateWaitCode&) {
-        std::cout << "Enter authentication code: " << std::flush;
+        [this, account, &name](td_api::authorizationStateWaitCode&) {
+        std::cout << name << "Enter authentication code: " << std::flush;
         std::string code;
         std::cin >> code;
-        send_authentication_query(
+        send_authentication_query(account,
           td_api::make_object<td_api::checkAuthenticationCode>(code),
-          create_authentication_query_handler());
+          create_authentication_query_handler(account));
       },
-        [this](td_api::authorizationStateWaitRegistration&) {
+        [this, account, &name](td_api::authorizationStateWaitRegistration&) {
         std::string first_name;
         std::string last_name;
-        std::cout << "Enter your first name: " << std::flush;
+        std::cout << name << "Enter your first name: " << std::flush;
         std::cin >> first_name;
-        std::cout << "Enter your last name: " << std::flush;
+        std::cout << name << "Enter your last name: " << std::flush;
         std::cin >> last_name;
-        send_authentication_query(td_api::make_object<td_api::registerUser>(
+        send_authentication_query(account, td_api::make_object<td_api::registerUser>(
           first_name, last_name, false),
-          create_authentication_query_handler());
+          create_authentication_query_handler(account));
       },
-        [this](td_api::authorizationStateWaitPassword&) {
-        std::cout << "Enter authentication password: " << std::flush;
+        [this, account, &name](td_api::authorizationStateWaitPassword&) {
+        std::cout << name << "Enter authentication password: " << std::flush;
         std::string password;
         std::getline(std::cin, password);
-        send_authentication_query(
+        send_authentication_query(account,
           td_api::make_object<td_api::checkAuthenticationPassword>(
             password),
-          create_authentication_query_handler());
+          create_authentication_query_handler(account));
       },
-        [this](td_api::authorizationStateWaitOtherDeviceConfirmation& state) {
-        std::cout << "Confirm this login link on another device: "
+        [this, account, &name](td_api::authorizationStateWaitOtherDeviceConfirmation& state) {
+        std::cout << name << "Confirm this login link on another device: "
           << state.link_ << std::endl;
       },
-        [this](td_api::authorizationStateWaitPhoneNumber&) {
-        std::cout << "Enter phone number: " << std::flush;
+        [this, account, &name](td_api::authorizationStateWaitPhoneNumber&) {
+        std::cout << name << "Enter phone number: " << std::flush;
         std::string phone_number;
         std::cin >> phone_number;
-        send_authentication_query(
+        send_authentication_query(account,
           td_api::make_object<td_api::setAuthenticationPhoneNumber>(
             phone_number, nullptr),
-          create_authentication_query_handler());
+          create_authentication_query_handler(account));
       },
-        [this](td_api::authorizationStateWaitEmailAddress&) {
-        std::cout << "Enter email address: " << std::flush;
+        [this, account, &name](td_api::authorizationStateWaitEmailAddress&) {
+        std::cout << name << "Enter email address: " << std::flush;
         std::string email_address;
         std::cin >> email_address;
-        send_authentication_query(
+        send_authentication_query(account,
           td_api::make_object<td_api::setAuthenticationEmailAddress>(
             email_address),
-          create_authentication_query_handler());
+          create_authentication_query_handler(account));
       },
-        [this](td_api::authorizationStateWaitEmailCode&) {
-        std::cout << "Enter email authentication code: " << std::flush;
+        [this, account, &name](td_api::authorizationStateWaitEmailCode&) {
+        std::cout << name << "Enter email authentication code: " << std::flush;
         std::string code;
         std::cin >> code;
-        send_authentication_query(
+        send_authentication_query(account,
           td_api::make_object<td_api::checkAuthenticationEmailCode>(
             td_api::make_object<td_api::emailAddressAuthenticationCode>(
               code)),
-          create_authentication_query_handler());
+          create_authentication_query_handler(account));
       },
-        /*          [this](td_api::authorizationStateWaitEncryptionKey&) {
-          std::cout << "Enter encryption key or DESTROY: " << std::flush;
+        /*          [this, account, &name](td_api::authorizationStateWaitEncryptionKey&) {
+          std::cout << name << "Enter encryption key or DESTROY: " << std::flush;
           std::string key;
           std::getline(std::cin, key);
           if (key == "DESTROY") {
-            send_authentication_query(td_api::make_object<td_api::destroy>(),
-                                      create_authentication_query_handler());
+            send_authentication_query(account, td_api::make_object<td_api::destroy>(),
+                                      create_authentication_query_handler(account));
           } else {
-            send_authentication_query(
+            send_authentication_query(account,
                 td_api::make_object<td_api::checkDatabaseEncryptionKey>(
                     std::move(key)),
-                create_authentication_query_handler());
+                create_authentication_query_handler(account));
           }
         }, */
-        [this](td_api::authorizationStateWaitTdlibParameters&) {
+        [this, account, &name](td_api::authorizationStateWaitTdlibParameters&) {
         auto requests = td_api::make_object<td_api::setTdlibParameters>();
-        requests->database_directory_ = "tdlib";
+        requests->database_directory_ = accounts_[account].database_directory;
         //              parameters->use_message_database_ = true;
         requests->use_secret_chats_ = true;
         // read ini file
@@ -206,26 +349,27 @@ void ClientWrapper::on_authorization_state_update() {
         requests->device_model_ = "Desktop";
         requests->application_version_ = "1.0";
         //requests->enable_storage_optimizer_ = false;
-        send_authentication_query(
+        send_authentication_query(account,
           std::move(requests),
-          create_authentication_query_handler());
+          create_authentication_query_handler(account));
       }));
 }
 
-void ClientWrapper::check_authentication_error(Object object) {
+void ClientWrapper::check_authentication_error(std::int32_t account, Object object) {
   if (object->get_id() == td_api::error::ID) {
     auto error = td::move_tl_object_as<td_api::error>(object);
     std::cout << "Error: " << to_string(error) << std::flush;
-    on_authorization_state_update();
+    on_authorization_state_update(account);
   }
 }
 
-void ClientWrapper::send_authentication_query(
+void ClientWrapper::send_authentication_query(std::int32_t account,
   td_api::object_ptr<td_api::Function> f,
   std::function<void(Object)> handler) {
   auto query_id = next_query_id();
   if (handler) {
     handlers_.emplace(query_id, std::move(handler));
   }
-  client_manager_->send(client_id_, query_id, std::move(f));
+  Metrics::instance().add(Metrics::kQueriesSent);
+  transport_->send(accounts_[account].client_id, query_id, std::move(f));
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "inc/column_file.h"
+
+using namespace task_api;
+
+namespace {
+const char exportMagic[8] = {'T', 'D', 'E', 'X', 'P', 'R', 'T', '1'};
+const char padding[8] = {};
+}  // namespace
+
+bool ColumnFileWriter::open(const std::string& path) {
+  close();
+  out_.open(path, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+  if (!out_.is_open()) {
+    return false;
+  }
+  out_.write(exportMagic, sizeof(exportMagic));
+  rows_ = 0;
+  bytes_ = sizeof(exportMagic);
+  caption_offsets_.assign(1, 0);
+  return out_.good();
+}
+
+void ColumnFileWriter::add(const ExportRow& row) {
+  msg_id_.push_back(row.msg_id);
+  date_.push_back(row.date);
+  sender_.push_back(row.sender);
+  content_type_.push_back(row.content_type);
+  file_id_.push_back(row.file_id);
+  file_size_.push_back(row.file_size);
+  captions_.append(row.caption);
+  caption_offsets_.push_back(static_cast<uint32_t>(captions_.size()));
+  ++rows_;
+  if (msg_id_.size() >= groupRows) {
+    flush();
+  }
+}
+
+void ColumnFileWriter::flush() {
+  if (msg_id_.empty() || !out_.is_open()) {
+    return;
+  }
+  uint32_t header[2] = {static_cast<uint32_t>(msg_id_.size()), 0};
+  out_.write(reinterpret_cast<const char*>(header), sizeof(header));
+  bytes_ += sizeof(header);
+  chunk(msg_id_.data(), msg_id_.size() * sizeof(int64_t));
+  chunk(date_.data(), date_.size() * sizeof(int32_t));
+  chunk(sender_.data(), sender_.size() * sizeof(int64_t));
+  chunk(content_type_.data(), content_type_.size() * sizeof(int32_t));
+  chunk(file_id_.data(), file_id_.size() * sizeof(int32_t));
+  chunk(file_size_.data(), file_size_.size() * sizeof(int64_t));
+  // offsets and bytes share a chunk, the bytes start after the offsets
+  chunk(caption_offsets_.data(), caption_offsets_.size() * sizeof(uint32_t),
+    captions_.data(), captions_.size());
+  out_.flush();
+
+  // clear() keeps the capacity, so the buffers are allocated once
+  msg_id_.clear();
+  date_.clear();
+  sender_.clear();
+  content_type_.clear();
+  file_id_.clear();
+  file_size_.clear();
+  caption_offsets_.assign(1, 0);
+  captions_.clear();
+}
+
+void ColumnFileWriter::close() {
+  if (out_.is_open()) {
+    flush();
+    out_.close();
+  }
+}
+
+void ColumnFileWriter::chunk(const void* data, std::size_t length,
+  const void* tail, std::size_t tail_length) {
+  uint64_t l = length + tail_length;
+  out_.write(reinterpret_cast<const char*>(&l), sizeof(l));
+  out_.write(static_cast<const char*>(data), length);
+  if (tail_length > 0) {
+    out_.write(static_cast<const char*>(tail), tail_length);
+  }
+  length += tail_length;
+  std::size_t pad = (8 - length % 8) % 8;
+  out_.write(padding, pad);
+  bytes_ += sizeof(l) + length + pad;
+}
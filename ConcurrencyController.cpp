@@ -0,0 +1,145 @@
+#include "inc/concurrency.h"
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+using namespace task_api;
+
+constexpr std::chrono::seconds ConcurrencyController::interval;
+
+void ConcurrencyConfig::load(const std::string& path) {
+  std::ifstream f(path);
+  for (std::string line; std::getline(f, line);) {
+    std::istringstream in_stream(line);
+    std::string key;
+    in_stream >> key;
+    if (key == "min") {
+      in_stream >> min;
+    }
+    else if (key == "max") {
+      in_stream >> max;
+    }
+    else if (key == "lookahead") {
+      in_stream >> lookahead;
+    }
+    else if (key == "window") {
+      Window w;
+      if (in_stream >> w.from_hour >> w.to_hour >> w.min >> w.max) {
+        windows.push_back(w);
+      }
+    }
+  }
+}
+
+void ConcurrencyConfig::bounds(int32_t& lo, int32_t& hi) const {
+  lo = min;
+  hi = max;
+  time_t t = time(nullptr);
+  int32_t hour = localtime(&t)->tm_hour;
+  for (auto& w : windows) {
+    bool in = w.from_hour <= w.to_hour
+      ? hour >= w.from_hour && hour < w.to_hour
+      : hour >= w.from_hour || hour < w.to_hour;
+    if (in) {
+      lo = w.min;
+      hi = w.max;
+      break;
+    }
+  }
+  lo = std::max(lo, 1);
+  hi = std::max(hi, lo);
+}
+
+ConcurrencyController::ConcurrencyController(const ConcurrencyConfig& config)
+  : config_(config), limit_(2) {
+  clamp();
+  interval_start_ = last_update_ = std::chrono::steady_clock::now();
+}
+
+void ConcurrencyController::on_complete(std::chrono::steady_clock::duration latency, int64_t size) {
+  if (size <= 0) {
+    return;
+  }
+  double seconds = std::chrono::duration<double>(latency).count();
+  latency_sum_ += seconds * (1 << 20) / size;
+  ++completions_;
+}
+
+void ConcurrencyController::update(int32_t in_flight) {
+  auto now = std::chrono::steady_clock::now();
+  busy_time_ += std::chrono::duration<double>(now - last_update_).count() * in_flight_;
+  last_update_ = now;
+  in_flight_ = in_flight;
+
+  if (now - interval_start_ >= interval) {
+    end_interval(std::chrono::duration<double>(now - interval_start_).count());
+    interval_start_ = now;
+    busy_time_ = 0;
+    bytes_ = 0;
+    errors_ = 0;
+    latency_sum_ = 0;
+    completions_ = 0;
+  }
+}
+
+void ConcurrencyController::end_interval(double seconds) {
+  throughput_ = bytes_ / seconds;
+  double used = busy_time_ / seconds;
+  bool saturated = used >= limit_ - 0.5;
+  if (completions_ > 0 && used > 0) {
+    // a download takes longer the more share the link, what is left shows
+    // the server slowing us down
+    double latency = latency_sum_ / completions_ / used;
+    latency_avg_ = latency_avg_ == 0 ? latency : 0.7 * latency_avg_ + 0.3 * latency;
+    latency_base_ = latency_base_ == 0 ? latency_avg_ : std::min(latency_base_, latency_avg_);
+  }
+  if (hold_ > 0) {
+    --hold_;
+  }
+
+  if (errors_ > 0) {
+    limit_ /= 2;
+    probing_ = false;
+    hold_ = holdIntervals;
+    best_throughput_ = 0;
+  }
+  else if (probing_) {
+    probing_ = false;
+    if (!saturated) {
+      // not enough work to tell, try again later
+      --limit_;
+    }
+    else if (throughput_ < best_throughput_ * gain) {
+      // the link was full already
+      --limit_;
+      hold_ = holdIntervals;
+    }
+    else {
+      best_throughput_ = throughput_;
+    }
+  }
+  else if (latency_base_ > 0 && latency_avg_ > 2 * latency_base_ &&
+    throughput_ < best_throughput_ * gain) {
+    --limit_;
+    hold_ = holdIntervals;
+    best_throughput_ = throughput_;
+    latency_avg_ = latency_base_;
+  }
+  else if (saturated && hold_ == 0) {
+    best_throughput_ = std::max(best_throughput_, throughput_);
+    ++limit_;
+    probing_ = true;
+  }
+  else if (saturated) {
+    best_throughput_ = std::max(best_throughput_, throughput_);
+  }
+  clamp();
+}
+
+void ConcurrencyController::clamp() {
+  int32_t lo, hi;
+  config_.bounds(lo, hi);
+  limit_ = std::min(std::max(limit_, lo), hi);
+}
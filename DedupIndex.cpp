@@ -0,0 +1,207 @@
+#include "inc/dedup_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using namespace task_api;
+
+namespace {
+const char dedupMagic[8] = {'T', 'D', 'D', 'E', 'D', 'U', 'P', '1'};
+
+std::size_t file_size(uint64_t capacity) {
+  return sizeof(uint64_t) * 4 + capacity * sizeof(uint64_t);
+}
+}  // namespace
+
+std::string& DedupIndex::directory() {
+  static std::string directory("tdlib");
+  return directory;
+}
+
+void DedupIndex::set_directory(const std::string& directory) {
+  DedupIndex::directory() = directory;
+}
+
+DedupIndex& DedupIndex::instance() {
+  static DedupIndex index(directory() + "/dedup.idx");
+  return index;
+}
+
+uint64_t DedupIndex::key(const std::string& unique_id, int64_t size) {
+  if (unique_id.empty()) {
+    return 0;
+  }
+  // FNV-1a, then the size mixed in with a splitmix64 finalizer
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : unique_id) {
+    h = (h ^ c) * 1099511628211ull;
+  }
+  h ^= static_cast<uint64_t>(size) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  h ^= h >> 31;
+  // 0 marks an empty slot
+  return h == 0 ? 1 : h;
+}
+
+DedupIndex::DedupIndex(const std::string& path) : path_(path) {
+  if (!map(path_, initialCapacity, false) && !map(path_, initialCapacity, true)) {
+    std::cout << "Failed to open [" << path_ << "], files are not deduplicated" << std::endl;
+  }
+}
+
+DedupIndex::~DedupIndex() {
+  unmap();
+}
+
+bool DedupIndex::map(const std::string& path, uint64_t capacity, bool create) {
+  int fd = ::open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (!create) {
+    Header h;
+    if (fstat(fd, &st) != 0 || ::pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+        std::memcmp(h.magic, dedupMagic, sizeof(dedupMagic)) != 0 ||
+        (h.capacity & (h.capacity - 1)) != 0 ||
+        static_cast<uint64_t>(st.st_size) < file_size(h.capacity)) {
+      ::close(fd);
+      return false;
+    }
+    capacity = h.capacity;
+  }
+  else if (::ftruncate(fd, file_size(capacity)) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  std::size_t length = file_size(capacity);
+  void* p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+  unmap();
+  fd_ = fd;
+  mapped_ = length;
+  header_ = static_cast<Header*>(p);
+  slots_ = static_cast<uint64_t*>(p) + 4;
+  if (create) {
+    std::memcpy(header_->magic, dedupMagic, sizeof(dedupMagic));
+    header_->capacity = capacity;
+    header_->count = 0;
+  }
+  return true;
+}
+
+void DedupIndex::unmap() {
+  if (header_ != nullptr) {
+    ::munmap(header_, mapped_);
+    header_ = nullptr;
+    slots_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool DedupIndex::find(uint64_t key) const {
+  uint64_t mask = header_->capacity - 1;
+  for (uint64_t i = key & mask;; i = (i + 1) & mask) {
+    if (slots_[i] == key) {
+      return true;
+    }
+    if (slots_[i] == 0) {
+      return false;
+    }
+  }
+}
+
+void DedupIndex::insert(uint64_t key) {
+  uint64_t mask = header_->capacity - 1;
+  uint64_t i = key & mask;
+  while (slots_[i] != 0) {
+    if (slots_[i] == key) {
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+  slots_[i] = key;
+  ++header_->count;
+}
+
+void DedupIndex::grow() {
+  std::string tmp = path_ + ".tmp";
+  uint64_t capacity = header_->capacity * 2;
+  Header* old_header = header_;
+  uint64_t* old_slots = slots_;
+  std::size_t old_mapped = mapped_;
+  int old_fd = fd_;
+  header_ = nullptr;
+  fd_ = -1;
+  if (!map(tmp, capacity, true)) {
+    header_ = old_header;
+    slots_ = old_slots;
+    fd_ = old_fd;
+    std::cout << "Failed to grow [" << path_ << "]" << std::endl;
+    return;
+  }
+  for (uint64_t i = 0; i < old_header->capacity; ++i) {
+    if (old_slots[i] != 0) {
+      insert(old_slots[i]);
+    }
+  }
+  ::msync(header_, mapped_, MS_SYNC);
+  std::rename(tmp.c_str(), path_.c_str());
+  ::munmap(old_header, old_mapped);
+  ::close(old_fd);
+}
+
+bool DedupIndex::contains(uint64_t key) {
+  std::lock_guard<std::mutex> lock(lock_);
+  return key != 0 && header_ != nullptr && find(key);
+}
+
+bool DedupIndex::claim(uint64_t key) {
+  if (key == 0) {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(lock_);
+  if (header_ != nullptr && find(key)) {
+    return false;
+  }
+  return claimed_.insert(key).second;
+}
+
+void DedupIndex::commit(uint64_t key) {
+  if (key == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(lock_);
+  claimed_.erase(key);
+  if (header_ == nullptr) {
+    return;
+  }
+  if ((header_->count + 1) * 10 > header_->capacity * 7) {
+    grow();
+  }
+  insert(key);
+}
+
+void DedupIndex::release(uint64_t key) {
+  std::lock_guard<std::mutex> lock(lock_);
+  claimed_.erase(key);
+}
+
+std::size_t DedupIndex::size() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return header_ != nullptr ? header_->count : 0;
+}
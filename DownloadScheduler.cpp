@@ -0,0 +1,160 @@
+#include "inc/task_api.h"
+
+using namespace task_api;
+
+extern ConcurrencyConfig ConcurrencyLimits;
+
+constexpr std::chrono::seconds DownloadScheduler::agingStep;
+
+DownloadScheduler& DownloadScheduler::instance() {
+  static DownloadScheduler scheduler;
+  return scheduler;
+}
+
+DownloadScheduler::DownloadScheduler() : controller_(ConcurrencyLimits) {}
+
+int32_t DownloadScheduler::add_job(TdTask* task, int32_t weight, int32_t priority) {
+  std::lock_guard<std::mutex> lock(lock_);
+  Job job;
+  job.task = task;
+  job.weight = std::max(weight, 1);
+  job.priority = priority;
+  jobs_.emplace(++next_job_, std::move(job));
+  return next_job_;
+}
+
+void DownloadScheduler::remove_job(int32_t job) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = jobs_.find(job);
+  if (it == jobs_.end()) {
+    return;
+  }
+  running_ -= it->second.running;
+  jobs_.erase(it);
+  controller_.update(running_);
+  dispatch();
+}
+
+std::shared_ptr<DownloadScheduler::Ticket> DownloadScheduler::submit(int32_t job) {
+  auto ticket = std::make_shared<Ticket>();
+  ticket->job = job;
+  ticket->queued = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = jobs_.find(job);
+  if (it != jobs_.end()) {
+    it->second.waiting.push_back(ticket);
+    dispatch();
+  }
+  return ticket;
+}
+
+void DownloadScheduler::release(const std::shared_ptr<Ticket>& ticket) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = jobs_.find(ticket->job);
+  if (it == jobs_.end()) {
+    return;
+  }
+  Job& job = it->second;
+  if (ticket->granted) {
+    --job.running;
+    --running_;
+    controller_.update(running_);
+  }
+  else {
+    for (auto t = job.waiting.begin(); t != job.waiting.end(); ++t) {
+      if (*t == ticket) {
+        job.waiting.erase(t);
+        break;
+      }
+    }
+  }
+  dispatch();
+}
+
+void DownloadScheduler::on_progress(int64_t bytes) {
+  // before taking lock_: add() may take Metrics' lock, which is never nested inside lock_
+  Metrics::instance().add(Metrics::kBytesDownloaded, bytes);
+  std::lock_guard<std::mutex> lock(lock_);
+  controller_.on_progress(bytes);
+  controller_.update(running_);
+  dispatch();
+}
+
+void DownloadScheduler::on_complete(std::chrono::steady_clock::duration latency, int64_t size) {
+  Metrics::instance().add(Metrics::kFilesDownloaded);
+  std::lock_guard<std::mutex> lock(lock_);
+  controller_.on_complete(latency, size);
+}
+
+void DownloadScheduler::on_error() {
+  Metrics::instance().add(Metrics::kDownloadErrors);
+  std::lock_guard<std::mutex> lock(lock_);
+  controller_.on_error();
+}
+
+int32_t DownloadScheduler::cap() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return controller_.limit();
+}
+
+int32_t DownloadScheduler::running() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return running_;
+}
+
+std::size_t DownloadScheduler::waiting() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return waiting_tickets();
+}
+
+void DownloadScheduler::print_status(std::ostream& out) {
+  std::lock_guard<std::mutex> lock(lock_);
+  out << "Download slots: " << running_ << " of " << controller_.limit() << " in use, "
+    << waiting_tickets() << " waiting, throughput " << controller_.throughput() / 1024 << " KB/s" << std::endl;
+}
+
+std::size_t DownloadScheduler::waiting_tickets() const {
+  std::size_t waiting = 0;
+  for (auto& j : jobs_) {
+    waiting += j.second.waiting.size();
+  }
+  return waiting;
+}
+
+void DownloadScheduler::dispatch() {
+  auto now = std::chrono::steady_clock::now();
+  while (running_ < controller_.limit()) {
+    Job* job = pick(now);
+    if (job == nullptr) {
+      return;
+    }
+    auto ticket = job->waiting.front();
+    job->waiting.pop_front();
+    ++job->running;
+    ++running_;
+    ticket->granted = true;
+    // the task is kept alive by TdMain until the executor is done with it
+    job->task->wake();
+  }
+}
+
+DownloadScheduler::Job* DownloadScheduler::pick(std::chrono::steady_clock::time_point now) {
+  Job* best = nullptr;
+  int64_t best_priority = 0;
+  for (auto& j : jobs_) {
+    Job& job = j.second;
+    if (job.waiting.empty()) {
+      continue;
+    }
+    int64_t priority = job.priority + (now - job.waiting.front()->queued) / agingStep;
+    if (best == nullptr || priority > best_priority ||
+        (priority == best_priority &&
+         // running/weight < best running/weight
+         static_cast<int64_t>(job.running) * best->weight <
+           static_cast<int64_t>(best->running) * job.weight)) {
+      best = &job;
+      best_priority = priority;
+    }
+  }
+  return best;
+}
@@ -1,27 +1,30 @@
 #include "inc/task_api.h"
 
+#include <algorithm>
 #include <unordered_map>
-#include <regex>
 #include <climits>
 
 using namespace task_api;
 
-extern std::unordered_map<int64_t, std::vector<std::string>> FileNamesLookUp;
+extern ExclusionEngine Exclusions;
 
-extern void clean_text(std::string& s);
+extern ConcurrencyConfig ConcurrencyLimits;
+
+constexpr std::chrono::minutes Downloader::retryInterval;
 
 
 Downloader::Downloader(int64_t chat, const std::string& title, int64_t msg, int32_t limit,
-  int32_t direction, ClientWrapper* client_ptr)
-  : TdTask(client_ptr),
+  int32_t direction, ClientWrapper* client_ptr, int32_t weight, int32_t priority,
+  int32_t account)
+  : TdTask(client_ptr, account),
   chat_id_(chat),
   chat_title_(title),
   last_msg_id_(msg),
-  direction_(direction) {
+  direction_(direction),
+  job_(DownloadScheduler::instance().add_job(this, weight, priority)),
+  index_(ScanIndex::open(chat, client_ptr->database_directory(account))) {
   std::time_t now = std::time(nullptr);
-  log_ = std::ofstream("tdlib/" + std::to_string(now) + "-" + std::to_string(chat) + "-downloading.log",
-    std::ios_base::out | std::ios_base::app);
-  client_ptr_->subscribe_update(td_api::updateFile::ID, this);
+  log_.open(client_ptr_->database_directory(account_) + "/" + std::to_string(now) + "-" + std::to_string(chat) + "-downloading.log");
   if (limit > 0) {
     limit_ = limit;
   }
@@ -30,180 +33,349 @@ Downloader::Downloader(int64_t chat, const std::string& title, int64_t msg, int3
   }
 }
 
-void Downloader::auto_download() {
-  while (downloaded_files_.size() < limit_ && !terminate_) {
-    if (handlers_.empty() && downloading_files_.empty()) {
-      if (up_to_date_) {
-        break;
-      }
-      retrieve_more_msg();
-    }
-
-    // waiting for download/responses
-    std::this_thread::sleep_for(std::chrono::minutes(2));
-    process_responses();
+StepResult Downloader::step() {
+  account_idle_slots();
+  if (!started_) {
+    started_ = true;
+    scanning_ = true;
+    scan_history();
+  }
+  process_responses();
+  start_downloads();
+  if ((limit_ > 0 && static_cast<std::int64_t>(downloaded_files_.size()) >= limit_) || terminate_ ||
+    (!scanning_ && downloading_files_.empty() && candidates_.empty())) {
+    finish();
+    return StepResult::kDone;
   }
 
+  // waiting for download/responses, or for the retry back off to pass
+  wake_at_ = next_timer();
+  parked_at_ = std::chrono::steady_clock::now();
+  parked_slots_ = get_concurrent_limit();
+  parked_busy_ = std::min(parked_slots_, static_cast<int32_t>(downloading_files_.size()));
+  return StepResult::kPark;
+}
+
+void Downloader::finish() {
   if (!downloading_files_.empty()) {
     for (auto file_id : downloading_files_) {
-      log_ << "WARN: Cancel downloading file id[" << file_id << "]." << std::endl;
+      log_(LogLevel::kWarn) << "Cancel downloading file id[" << file_id << "].";
       send_query(
         td_api::make_object<td_api::cancelDownloadFile>(file_id, false), {});
+      client_ptr_->unroute_file(file_id, account_);
+      index_->release_file(file_id);
+      DedupIndex::instance().release(dedup_keys_[file_id]);
     }
   }
+  for (auto& c : candidates_) {
+    index_->release_file(c.file_id);
+    DedupIndex::instance().release(dedup_keys_[c.file_id]);
+  }
+  candidates_.clear();
+  DownloadScheduler::instance().remove_job(job_);
+  destroy_coroutines();
 
-  log_ << "INFO: Downloader exiting... total downloaded files: [" << downloaded_files_.size() << "]" << std::endl;
+  log_(LogLevel::kInfo) << "Downloader exiting... total downloaded files: [" << downloaded_files_.size() << "]";
+  log_.close();
 }
 
-void Downloader::retrieve_more_msg() {
-  if (last_msg_id_ == 0) {
-    send_query(
-      td_api::make_object<td_api::getChatHistory>(chat_id_, 0, 0, 1, false),
-      [this](Object object) {
-        if (this->log_msg_if_error(
-          object, "Failed to get the last message from chat: ")) {
-          return;
-        }
+void Downloader::account_idle_slots() {
+  if (parked_slots_ == 0) {
+    return;
+  }
+  double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - parked_at_).count();
+  slot_idle_time_ += waited * (parked_slots_ - parked_busy_);
+  slot_time_ += waited * parked_slots_;
+  parked_slots_ = 0;
+}
 
-        auto messages = td::move_tl_object_as<td_api::messages>(object);
-        if (messages->messages_.size() < 1) {
-          log_ << "ERROR: 0 message returned while retrieving the last "
-            "message "
-            "id, will have to try again"
-            << std::endl;
-          return;
-        }
+bool Downloader::scan_ahead() {
+  std::size_t wanted = downloaded_files_.size() + downloading_files_.size() + candidates_.size();
+  return pages_.size() < static_cast<std::size_t>(std::max(ConcurrencyLimits.lookahead, 1)) &&
+    candidates_.size() < maxCandidates && wanted < static_cast<std::size_t>(limit_);
+}
 
-        auto& msg = messages->messages_.at(0);
-        do_download_if_video(msg);
-      });
+void Downloader::start_downloads() {
+  std::size_t slots = get_concurrent_limit();
+  while (!candidates_.empty() && downloading_files_.size() < slots &&
+    downloaded_files_.size() + downloading_files_.size() < static_cast<std::size_t>(limit_)) {
+    Candidate c = std::move(candidates_.front());
+    candidates_.pop_front();
+    download(c.file_id, std::move(c.caption), c.msg_id, c.page);
   }
-  else {
-    int32_t num =
-      std::min(get_concurrent_limit(),
-        limit_ - static_cast<int32_t>(downloaded_files_.size()));
+}
+
+Coroutine Downloader::scan_history() {
+  while (last_msg_id_ == 0 && !terminate_) {
+    auto result = co_await query<td_api::messages>(
+      td_api::make_object<td_api::getChatHistory>(chat_id_, 0, 0, 1, false));
+    if (log_msg_if_error(result, "Failed to get the last message from chat: ")) {
+      co_await sleep_until(retry_at_);
+      continue;
+    }
+
+    auto messages = result.value();
+    if (messages->messages_.size() < 1) {
+      log_(LogLevel::kError) << "0 message returned while retrieving the last "
+        "message "
+        "id, will have to try again";
+      retry_at_ = std::chrono::steady_clock::now() + retryInterval;
+      co_await sleep_until(retry_at_);
+      continue;
+    }
+
+    page_ = open_page(0, false);
+    do_download_if_video(messages->messages_.at(0));
+    close_page(page_);
+  }
+
+  // full pages are fetched while earlier downloads are running, up to
+  // lookahead pages ahead of the downloads
+  while (!up_to_date_ && !terminate_) {
+    co_await wait_until([this] { return scan_ahead() || terminate_; });
+    if (terminate_ || skip_scanned()) {
+      break;
+    }
+    int32_t num = pageSize - 1;
     int32_t offset = 0;
     if (direction_ < 0) {
       ++num;
       offset = -num;
     }
+    else if (last_msg_handled_) {
+      // the page starts with last_msg_id_ itself, which was handled already
+      ++num;
+    }
 
-    send_query(td_api::make_object<td_api::getChatHistory>(
-      chat_id_, last_msg_id_, offset, num, false),
-      [this, num](Object object) {
-        if (this->log_msg_if_error(
-          object,
-          "Failed to get messages from chat(will retry "
-          "later): ")) {
-          return;
-        }
+    auto result = co_await query<td_api::messages>(
+      td_api::make_object<td_api::getChatHistory>(
+        chat_id_, last_msg_id_, offset, num, false));
+    if (log_msg_if_error(result,
+      "Failed to get messages from chat(will retry "
+      "later): ")) {
+      co_await sleep_until(retry_at_);
+      continue;
+    }
 
-        auto messages =
-          td::move_tl_object_as<td_api::messages>(object);
-        if (messages->messages_.size() < num) {
-          this->up_to_date_ = true;
-        }
+    auto messages = result.value();
+    // TDLib returns short pages anywhere in the history, only a page with
+    // nothing past last_msg_id_ is the end of it
+    if (std::all_of(messages->messages_.begin(), messages->messages_.end(),
+      [this](const td_api::object_ptr<td_api::message>& m) { return m->id_ == last_msg_id_; })) {
+      up_to_date_ = true;
+    }
 
-        if (this->direction_ > 0) {
-          for (auto m = messages->messages_.begin();
-            m != messages->messages_.end(); ++m) {
-            do_download_if_video(*m);
-          }
-        }
-        else {
-          for (auto m = ++messages->messages_.rbegin();
-            m != messages->messages_.rend(); ++m) {
-            do_download_if_video(*m);
-          }
+    page_ = open_page(last_msg_id_, last_msg_handled_);
+    if (direction_ > 0) {
+      for (auto m = messages->messages_.begin();
+        m != messages->messages_.end(); ++m) {
+        if (last_msg_handled_ && (*m)->id_ == last_msg_id_) {
+          continue;
         }
-      });
+        do_download_if_video(*m);
+      }
+    }
+    else {
+      for (auto m = ++messages->messages_.rbegin();
+        m != messages->messages_.rend(); ++m) {
+        do_download_if_video(*m);
+      }
+    }
+    if (direction_ > 0 && up_to_date_) {
+      // reached the beginning of the chat
+      pages_[page_].lo = chatStart;
+    }
+    close_page(page_);
+  }
+  scanning_ = false;
+}
+
+bool Downloader::skip_scanned() {
+  int64_t lo, hi;
+  if (last_msg_id_ == 0 || !index_->covered(last_msg_id_, lo, hi)) {
+    return false;
+  }
+  if (direction_ > 0 && lo <= chatStart) {
+    log_(LogLevel::kInfo) << "History before msg_id ["
+      << last_msg_id_ << "] was scanned already.";
+    up_to_date_ = true;
+    return true;
+  }
+  int64_t to = direction_ > 0 ? lo : hi;
+  if (to != last_msg_id_) {
+    log_(LogLevel::kInfo) << "Skipping scanned msg_id range ["
+      << lo << ", " << hi << "].";
+  }
+  last_msg_id_ = to;
+  last_msg_handled_ = true;
+  return false;
+}
+
+int32_t Downloader::open_page(int64_t anchor, bool anchored) {
+  Page& page = pages_[++last_page_];
+  if (anchored) {
+    page.lo = page.hi = anchor;
   }
+  return last_page_;
+}
+
+void Downloader::close_page(int32_t page) {
+  pages_[page].scanned = true;
+  commit_page(page);
+}
+
+void Downloader::commit_page(int32_t page) {
+  auto it = pages_.find(page);
+  if (it == pages_.end() || !it->second.scanned || it->second.pending > 0) {
+    return;
+  }
+  if (!it->second.failed && it->second.lo <= it->second.hi) {
+    index_->add_range(it->second.lo, it->second.hi);
+  }
+  pages_.erase(it);
+}
+
+Coroutine Downloader::download(int32_t file_id, std::string caption, int64_t msg_id, int32_t page) {
+  downloading_files_.insert(file_id);
+  client_ptr_->route_file(file_id, this, account_);
+  auto& scheduler = DownloadScheduler::instance();
+  auto ticket = scheduler.submit(job_);
+  auto granted = &ticket->granted;
+  co_await wait_until([granted] { return granted->load(); });
+  auto started = std::chrono::steady_clock::now();
+  // both spans of a file share one track
+  uint64_t trace_id = (static_cast<uint64_t>(account_) << 32) | static_cast<uint32_t>(file_id);
+  if (Tracer::enabled()) {
+    Tracer::instance().record({.name = "slot wait", .category = "download", .async = true,
+      .id = trace_id, .begin = ticket->queued, .end = started});
+  }
+  auto result = co_await query<td_api::file>(
+    td::make_tl_object<td_api::downloadFile>(file_id, 1, 0, 0, false));
+  if (log_msg_if_error(result, "Failed to start file downloading: ")) {
+    fail_download(file_id, page, ticket);
+    co_return;
+  }
+
+  auto file = result.value();
+  log_(LogLevel::kInfo) << "File [" << caption << "], id [" << file_id << "], msg_id ["
+    << msg_id << "] downloading started...";
+  if (!file->local_->is_downloading_completed_) {
+    file = co_await file_completed(file_id);
+  }
+  if (!file->local_->is_downloading_completed_) {
+    log_(LogLevel::kWarn) << "File [" << caption << "], id [" << file_id
+      << "] stopped downloading before it completed.";
+    fail_download(file_id, page, ticket);
+    co_return;
+  }
+
+  track_progress(*file);
+  progress_.remove(file_id);
+  auto& f = file->local_;
+  if (Tracer::enabled()) {
+    Tracer::instance().record({.name = "download", .category = "download", .async = true,
+      .id = trace_id, .begin = started, .end = std::chrono::steady_clock::now(),
+      .arg_name = "bytes", .arg = f->downloaded_size_});
+  }
+  scheduler.on_complete(std::chrono::steady_clock::now() - started, f->downloaded_size_);
+  scheduler.release(ticket);
+  normalize_text(f->path_, false);
+  log_(LogLevel::kInfo) << "File ["
+    << f->path_ << "], id[" << file_id
+    << "] download completed.";
+  client_ptr_->unroute_file(file_id, account_);
+  downloading_files_.erase(file_id);
+  downloaded_files_.insert(file_id);
+  index_->add_file(file_id);
+  DedupIndex::instance().commit(dedup_keys_[file_id]);
+  dedup_keys_.erase(file_id);
+  --pages_[page].pending;
+  commit_page(page);
+}
+
+void Downloader::fail_download(int32_t file_id, int32_t page,
+  const std::shared_ptr<DownloadScheduler::Ticket>& ticket) {
+  auto& scheduler = DownloadScheduler::instance();
+  scheduler.on_error();
+  scheduler.release(ticket);
+  progress_.remove(file_id);
+  client_ptr_->unroute_file(file_id, account_);
+  downloading_files_.erase(file_id);
+  index_->release_file(file_id);
+  DedupIndex::instance().release(dedup_keys_[file_id]);
+  dedup_keys_.erase(file_id);
+  // its range has to be scanned again
+  pages_[page].failed = true;
+  --pages_[page].pending;
+  commit_page(page);
 }
 
 void Downloader::do_download_if_video(
   const td_api::object_ptr<td_api::message>& mptr) {
+  // every scanned message goes into the local search index
+  SearchIndex::instance().add(chat_id_, mptr->id_, searchable_text(*mptr));
   if (!mptr->forward_info_
     && mptr->content_->get_id() == td_api::messageVideo::ID) {
     auto& msg_content =
       static_cast<const td_api::messageVideo&>(*mptr->content_);
-    std::string caption = std::regex_replace(msg_content.caption_->text_,
-      std::regex("\\s+"), " ");
-    clean_text(caption);
+    std::string caption = msg_content.caption_->text_;
+    normalize_text(caption, true);
     int64_t msg_id = mptr->id_;
-    int32_t file_id = msg_content.video_->video_->id_;
+    auto& video = *msg_content.video_->video_;
+    int32_t file_id = video.id_;
 
     if (downloaded_files_.find(file_id) == downloaded_files_.end() &&
       downloading_files_.find(file_id) == downloading_files_.end()) {
-      auto exlusionList = FileNamesLookUp.find(this->chat_id_);
-      bool download = true;
-      if (exlusionList != FileNamesLookUp.end()) {
-        for (auto& name : exlusionList->second) {
-          if (msg_content.video_->file_name_ == name) {
-            download = false;
-            break;
-          }
-        }
+      bool wanted = !Exclusions.excluded(chat_id_, msg_content.video_->file_name_);
+      uint64_t key = video.remote_ ? DedupIndex::key(video.remote_->unique_id_, video.size_) : 0;
+      if (wanted && !DedupIndex::instance().claim(key)) {
+        log_(LogLevel::kInfo) << "File [" << caption << "], id [" << file_id << "], msg_id ["
+          << msg_id << "] downloaded from another message already.";
       }
-      if (download) {
-        send_query(
-          td::make_tl_object<td_api::downloadFile>(file_id, 1, 0, 0, false),
-          [this, caption, msg_id](Object object) {
-            if (this->log_msg_if_error(object, "Failed to start file downloading: ")) {
-              return;
-            }
-            int32_t id = static_cast<const td_api::file&>(*object).id_;
-            log_ << get_current_timestamp() << " INFO: "
-              << "File [" << caption << "], id [" << id << "], msg_id ["
-              << msg_id << "] downloading started..." << std::endl;
-            downloading_files_.insert(id);
-          });
+      else if (wanted && !index_->claim_file(file_id)) {
+        DedupIndex::instance().release(key);
+        log_(LogLevel::kInfo) << "File [" << caption << "], id [" << file_id << "], msg_id ["
+          << msg_id << "] downloaded already.";
+      }
+      else if (wanted) {
+        ++pages_[page_].pending;
+        dedup_keys_[file_id] = key;
+        candidates_.push_back(Candidate{file_id, std::move(caption), msg_id, page_});
       }
       else {
-        log_ << get_current_timestamp() << " INFO: "
-          << "File [" << caption << "], id [" << file_id << "], msg_id ["
-          << msg_id << "] downloading skipped." << std::endl;
+        log_(LogLevel::kInfo) << "File [" << caption << "], id [" << file_id << "], msg_id ["
+          << msg_id << "] downloading skipped.";
       }
     }
   }
   last_msg_id_ = mptr->id_;
+  last_msg_handled_ = true;
+  Page& page = pages_[page_];
+  page.lo = std::min(page.lo, mptr->id_);
+  page.hi = std::max(page.hi, mptr->id_);
 }
 
 void Downloader::process_update(Object& update) {
   td_api::downcast_call(
     *update, overloaded(
+      // only the files routed to this task arrive here; completions are
+      // taken by their coroutines
       [this](td_api::updateFile& update_file) {
-        auto& f = update_file.file_->local_;
-        int32_t id = update_file.file_->id_;
-        // std::cout << "File [" << f->path_ << "] status: is
-        // completed
-        // [" << f->is_downloading_completed_ << "]" << std::endl;
-        if (f->is_downloading_completed_) {
-          clean_text(f->path_);
-          log_ << get_current_timestamp() << " INFO: File ["
-            << f->path_ << "], id[" << id
-            << "] download completed." << std::endl;
-          if (downloading_files_.erase(id) == 1) {
-            downloaded_files_.insert(id);
-          }
-          else {
-            log_ << get_current_timestamp()
-              << " WARN: Unexpected downloading... file id["
-              << id << "]." << std::endl;
-          }
+        // an update queued before the download finished
+        if (downloading_files_.find(update_file.file_->id_) != downloading_files_.end()) {
+          track_progress(*update_file.file_);
         }
       },
       [](auto& update) {}));
 }
 
 int32_t Downloader::get_concurrent_limit() {
-  time_t t = time(nullptr);
-  int32_t hour = localtime(&t)->tm_hour;
-  if (hour < 6) {
-    return nightModeLimit;
-  }
-  else {
-    return daytimeModeLimit;
-  }
+  return DownloadScheduler::instance().cap();
+}
+
+void Downloader::track_progress(const td_api::file& file) {
+  int64_t expected = file.size_ > 0 ? file.size_ : file.expected_size_;
+  DownloadScheduler::instance().on_progress(progress_.update(file.id_, expected, file.local_->downloaded_size_));
 }
 
 void Downloader::print_status() {
@@ -213,9 +385,14 @@ void Downloader::print_status() {
   std::cout << "  direction: " << (direction_ > 0 ? "backward" : "forward") << std::endl;
   std::cout << "  chat_id: " << chat_id_ << std::endl;
   std::cout << "  chat_title: " << chat_title_ << std::endl;
+  std::cout << "  account: " << client_ptr_->database_directory(account_) << std::endl;
   std::cout << "  max to download: " << limit_ << std::endl;
   std::cout << "  completed: " << downloaded_files_.size() << std::endl;
   std::cout << "  in progress: " << downloading_files_.size() << std::endl;
+  std::cout << "  progress: " << progress_.totals() << std::endl;
+  progress_.print(std::cout);
+  std::cout << "  idle slot time: " << slot_idle_time_ << "s ("
+    << (slot_time_ > 0 ? 100 * slot_idle_time_ / slot_time_ : 0) << "% of waiting)" << std::endl;
   std::cout << "  awaiting request: " << handlers_.size() << std::endl;
   std::cout << "  last msg id: " << last_msg_id_ << std::endl;
 }
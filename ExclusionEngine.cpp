@@ -0,0 +1,137 @@
+#include "inc/exclusions.h"
+
+#include <sys/stat.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace task_api;
+
+namespace {
+const std::string globMarker = "glob:";
+}  // namespace
+
+constexpr std::chrono::seconds ExclusionEngine::checkInterval;
+
+void ExclusionEngine::load(const std::string& path) {
+  {
+    std::lock_guard<std::mutex> lock(reload_lock_);
+    path_ = path;
+    mtime_ = 0;
+    file_size_ = -1;
+  }
+  next_check_ = 0;
+  reload_if_changed();
+}
+
+void ExclusionEngine::reload_if_changed() {
+  int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+  int64_t next = next_check_.load();
+  if (now < next) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(reload_lock_, std::try_to_lock);
+  // another thread is checking already
+  if (!lock.owns_lock()) {
+    return;
+  }
+  next_check_ = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    checkInterval).count();
+
+  struct stat st;
+  if (path_.empty() || ::stat(path_.c_str(), &st) != 0 ||
+      (st.st_mtime == mtime_ && st.st_size == file_size_)) {
+    return;
+  }
+  std::ifstream f(path_);
+  if (!f.is_open()) {
+    return;
+  }
+  mtime_ = st.st_mtime;
+  file_size_ = st.st_size;
+
+  auto rules = std::make_shared<Rules>();
+  for (std::string line; std::getline(f, line);) {
+    std::istringstream in_stream(line);
+    int64_t chat_id;
+    if (!(in_stream >> chat_id)) {
+      continue;
+    }
+    ChatRules& chat = (*rules)[chat_id];
+    for (std::string n; in_stream >> n;) {
+      if (n.compare(0, globMarker.size(), globMarker) != 0) {
+        chat.names.insert(n);
+        continue;
+      }
+      n.erase(0, globMarker.size());
+      std::size_t wildcard = n.find_first_of("*?");
+      if (wildcard == std::string::npos) {
+        chat.names.insert(n);
+      }
+      else if (wildcard == n.size() - 1 && n.back() == '*') {
+        chat.prefixes.push_back(n.substr(0, wildcard));
+      }
+      else {
+        chat.globs.push_back(n);
+      }
+    }
+  }
+  std::atomic_store_explicit(&rules_, std::shared_ptr<const Rules>(std::move(rules)),
+    std::memory_order_release);
+}
+
+bool ExclusionEngine::excluded(int64_t chat_id, const std::string& file_name) {
+  reload_if_changed();
+  auto rules = std::atomic_load_explicit(&rules_, std::memory_order_acquire);
+  auto it = rules->find(chat_id);
+  if (it == rules->end()) {
+    return false;
+  }
+  const ChatRules& chat = it->second;
+  if (chat.names.find(file_name) != chat.names.end()) {
+    return true;
+  }
+  for (auto& prefix : chat.prefixes) {
+    if (file_name.compare(0, prefix.size(), prefix) == 0) {
+      return true;
+    }
+  }
+  for (auto& glob : chat.globs) {
+    if (glob_match(glob.c_str(), file_name.c_str())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::size_t ExclusionEngine::size() const {
+  return std::atomic_load_explicit(&rules_, std::memory_order_acquire)->size();
+}
+
+bool ExclusionEngine::glob_match(const char* pattern, const char* name) {
+  // backtracks to the last '*' only, which is enough for '*' and '?'
+  const char* star = nullptr;
+  const char* resume = nullptr;
+  while (*name != '\0') {
+    if (*pattern == '*') {
+      star = pattern++;
+      resume = name;
+    }
+    else if (*pattern == '?' || *pattern == *name) {
+      ++pattern;
+      ++name;
+    }
+    else if (star != nullptr) {
+      pattern = star + 1;
+      name = ++resume;
+    }
+    else {
+      return false;
+    }
+  }
+  while (*pattern == '*') {
+    ++pattern;
+  }
+  return *pattern == '\0';
+}
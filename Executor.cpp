@@ -0,0 +1,187 @@
+#include "inc/task_api.h"
+
+#include <algorithm>
+
+using namespace task_api;
+
+namespace {
+// lets a worker push re-queued tasks onto its own deque
+thread_local const Executor* currentExecutor = nullptr;
+thread_local std::size_t currentWorker = 0;
+}  // namespace
+
+Executor::Executor(std::size_t threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (std::size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(new Worker());
+  }
+  for (std::size_t i = 0; i < threads; ++i) {
+    threads_.emplace_back(&Executor::work, this, i);
+  }
+}
+
+Executor::~Executor() {
+  {
+    std::lock_guard<std::mutex> lock(idle_lock_);
+    stopping_ = true;
+  }
+  idle_cv_.notify_all();
+  for (auto& t : threads_) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
+}
+
+void Executor::submit(TdTask* task) {
+  task->executor_ = this;
+  task->sched_state_.store(TdTask::kQueued);
+  enqueue(task, false);
+}
+
+void Executor::wake(TdTask* task) {
+  int state = task->sched_state_.load();
+  for (;;) {
+    if (state == TdTask::kParked) {
+      if (task->sched_state_.compare_exchange_weak(state, TdTask::kQueued)) {
+        enqueue(task, false);
+        return;
+      }
+    }
+    else if (state == TdTask::kRunning) {
+      // the worker running it re-queues it instead of parking
+      if (task->sched_state_.compare_exchange_weak(state, TdTask::kNotified)) {
+        return;
+      }
+    }
+    else {
+      return;
+    }
+  }
+}
+
+void Executor::wait(TdTask* task) {
+  std::unique_lock<std::mutex> lock(done_lock_);
+  done_cv_.wait(lock, [task] { return task->sched_state_ == TdTask::kDone; });
+}
+
+void Executor::enqueue(TdTask* task, bool front) {
+  std::size_t index = currentExecutor == this
+    ? currentWorker : next_worker_++ % workers_.size();
+  {
+    Worker& worker = *workers_[index];
+    std::lock_guard<std::mutex> lock(worker.lock);
+    if (front) {
+      worker.jobs.push_front(task);
+    }
+    else {
+      worker.jobs.push_back(task);
+    }
+  }
+  queued_.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> lock(idle_lock_);
+  }
+  idle_cv_.notify_one();
+}
+
+TdTask* Executor::take(std::size_t index) {
+  std::size_t n = workers_.size();
+  for (std::size_t i = 0; i < n; ++i) {
+    Worker& worker = *workers_[(index + i) % n];
+    std::lock_guard<std::mutex> lock(worker.lock);
+    if (worker.jobs.empty()) {
+      continue;
+    }
+    TdTask* task;
+    if (i == 0) {
+      task = worker.jobs.back();
+      worker.jobs.pop_back();
+    }
+    else {
+      task = worker.jobs.front();
+      worker.jobs.pop_front();
+    }
+    queued_.fetch_sub(1);
+    return task;
+  }
+  return nullptr;
+}
+
+void Executor::work(std::size_t index) {
+  currentExecutor = this;
+  currentWorker = index;
+  for (;;) {
+    TdTask* task = take(index);
+    if (task != nullptr) {
+      run_step(task);
+      continue;
+    }
+
+    std::vector<TdTask*> due;
+    {
+      std::unique_lock<std::mutex> lock(idle_lock_);
+      if (stopping_) {
+        return;
+      }
+      auto now = std::chrono::steady_clock::now();
+      while (!timers_.empty() && timers_.begin()->first <= now) {
+        due.push_back(timers_.begin()->second);
+        timers_.erase(timers_.begin());
+      }
+      if (due.empty() && queued_ == 0) {
+        if (timers_.empty()) {
+          idle_cv_.wait(lock);
+        }
+        else {
+          idle_cv_.wait_until(lock, timers_.begin()->first);
+        }
+      }
+    }
+    for (auto t : due) {
+      wake(t);
+    }
+  }
+}
+
+void Executor::run_step(TdTask* task) {
+  task->sched_state_.store(TdTask::kRunning);
+  StepResult result = task->step();
+
+  if (result != StepResult::kYield) {
+    std::lock_guard<std::mutex> lock(idle_lock_);
+    for (auto it = timers_.begin(); it != timers_.end(); ++it) {
+      if (it->second == task) {
+        timers_.erase(it);
+        break;
+      }
+    }
+    if (result == StepResult::kPark &&
+        task->wake_at_ != std::chrono::steady_clock::time_point::max()) {
+      timers_.emplace(task->wake_at_, task);
+      idle_cv_.notify_one();
+    }
+  }
+
+  if (result == StepResult::kDone) {
+    {
+      std::lock_guard<std::mutex> lock(done_lock_);
+      task->sched_state_.store(TdTask::kDone);
+    }
+    done_cv_.notify_all();
+    return;
+  }
+
+  if (result == StepResult::kPark) {
+    int expected = TdTask::kRunning;
+    if (task->sched_state_.compare_exchange_strong(expected, TdTask::kParked)) {
+      return;
+    }
+  }
+
+  // yielded, or woken up while it was running
+  task->sched_state_.store(TdTask::kQueued);
+  enqueue(task, result == StepResult::kYield);
+}
@@ -0,0 +1,151 @@
+#include "inc/task_api.h"
+
+using namespace task_api;
+
+constexpr std::chrono::seconds HistoryExporter::retryInterval;
+
+namespace {
+const td_api::file* message_file(const td_api::MessageContent& content) {
+  switch (content.get_id()) {
+    case td_api::messageVideo::ID:
+      return static_cast<const td_api::messageVideo&>(content).video_->video_.get();
+    case td_api::messageDocument::ID:
+      return static_cast<const td_api::messageDocument&>(content).document_->document_.get();
+    case td_api::messagePhoto::ID: {
+      auto& sizes = static_cast<const td_api::messagePhoto&>(content).photo_->sizes_;
+      return sizes.empty() ? nullptr : sizes.back()->photo_.get();
+    }
+    default:
+      return nullptr;
+  }
+}
+
+std::string message_caption(const td_api::MessageContent& content) {
+  switch (content.get_id()) {
+    case td_api::messageText::ID:
+      return static_cast<const td_api::messageText&>(content).text_->text_;
+    case td_api::messagePhoto::ID:
+      return static_cast<const td_api::messagePhoto&>(content).caption_->text_;
+    case td_api::messageVideo::ID:
+      return static_cast<const td_api::messageVideo&>(content).caption_->text_;
+    case td_api::messageDocument::ID:
+      return static_cast<const td_api::messageDocument&>(content).caption_->text_;
+    default:
+      return std::string();
+  }
+}
+}  // namespace
+
+HistoryExporter::HistoryExporter(std::int64_t chat_id, const std::string& path,
+  std::int64_t from_msg_id, std::int64_t limit, ClientWrapper* client_ptr, std::int32_t account)
+  : TdTask(client_ptr, account),
+  chat_id_(chat_id),
+  path_(path),
+  from_msg_id_(from_msg_id),
+  limit_(limit) {}
+
+StepResult HistoryExporter::step() {
+  if (!started_) {
+    started_ = true;
+    export_history();
+  }
+  process_responses();
+  if (finished_ || terminate_) {
+    destroy_coroutines();
+    writer_.close();
+    return StepResult::kDone;
+  }
+  wake_at_ = next_timer();
+  return StepResult::kPark;
+}
+
+void HistoryExporter::request_page(std::int64_t from_msg_id) {
+  send_query(td_api::make_object<td_api::getChatHistory>(chat_id_, from_msg_id, 0, pageSize, false),
+    [this](Object object) {
+      next_page_ = std::move(object);
+      next_ready_ = true;
+    });
+}
+
+Coroutine HistoryExporter::export_history() {
+  started_at_ = std::chrono::steady_clock::now();
+  if (!writer_.open(path_)) {
+    std::cout << "Failed to open [" << path_ << "] for the export of chat [" << chat_id_ << "]" << std::endl;
+    finished_ = true;
+    co_return;
+  }
+
+  std::int64_t from = from_msg_id_;
+  bool first_page = true;
+  request_page(from);
+  while (!terminate_) {
+    co_await wait_until([this] { return next_ready_; });
+    next_ready_ = false;
+    QueryResult<td_api::messages> result(std::move(next_page_));
+    if (!result.ok()) {
+      std::cout << "Failed to get messages from chat [" << chat_id_
+        << "] for the export (will retry later): " << result.error() << std::endl;
+      co_await sleep_until(std::chrono::steady_clock::now() + retryInterval);
+      request_page(from);
+      continue;
+    }
+
+    auto messages = result.value();
+    auto& list = messages->messages_;
+    // later pages start with the last message of the previous one
+    std::size_t first = !first_page && !list.empty() && list.front()->id_ == from ? 1 : 0;
+    first_page = false;
+    if (list.size() <= first) {
+      // reached the beginning of the chat
+      break;
+    }
+    from = list.back()->id_;
+    auto page_rows = static_cast<std::int64_t>(list.size() - first);
+    bool more = limit_ <= 0 || static_cast<std::int64_t>(writer_.rows()) + page_rows < limit_;
+    if (more) {
+      request_page(from);
+    }
+    for (std::size_t i = first; i < list.size(); ++i) {
+      if (limit_ > 0 && static_cast<std::int64_t>(writer_.rows()) >= limit_) {
+        break;
+      }
+      write_row(*list[i]);
+    }
+    if (!more) {
+      break;
+    }
+  }
+  writer_.close();
+  std::cout << "Exported [" << writer_.rows() << "] messages of chat [" << chat_id_
+    << "] to [" << path_ << "]." << std::endl;
+  finished_ = true;
+}
+
+void HistoryExporter::write_row(const td_api::message& m) {
+  ExportRow row;
+  row.msg_id = m.id_;
+  row.date = m.date_;
+  td_api::downcast_call(
+    const_cast<td_api::MessageSender&>(*m.sender_id_),
+    overloaded(
+      [&row](td_api::messageSenderUser& user) { row.sender = user.user_id_; },
+      [&row](td_api::messageSenderChat& chat) { row.sender = chat.chat_id_; }));
+  row.content_type = m.content_->get_id();
+  const td_api::file* file = message_file(*m.content_);
+  if (file != nullptr) {
+    row.file_id = file->id_;
+    row.file_size = file->size_ > 0 ? file->size_ : file->expected_size_;
+  }
+  row.caption = message_caption(*m.content_);
+  writer_.add(row);
+}
+
+void HistoryExporter::print_status() {
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at_).count();
+  std::cout << "History exporter status: " << std::endl;
+  std::cout << "  chat_id: " << chat_id_ << std::endl;
+  std::cout << "  file: " << path_ << std::endl;
+  std::cout << "  messages: " << writer_.rows() << " (" << writer_.bytes() / 1024 << " KB written)" << std::endl;
+  std::cout << "  rate: " << (seconds > 0 ? writer_.rows() / seconds : 0) << " messages/s" << std::endl;
+  std::cout << "  done: " << finished_ << std::endl;
+}
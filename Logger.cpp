@@ -0,0 +1,281 @@
+#include "inc/logger.h"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace task_api;
+
+constexpr std::chrono::milliseconds Logger::flushInterval;
+
+namespace {
+const char* level_name(LogLevel level) {
+  switch (level) {
+    case LogLevel::kDebug:
+      return "DEBUG";
+    case LogLevel::kInfo:
+      return "INFO";
+    case LogLevel::kWarn:
+      return "WARN";
+    default:
+      return "ERROR";
+  }
+}
+
+// lines per writev, well below IOV_MAX
+const std::size_t maxIov = 256;
+}  // namespace
+
+Logger& Logger::instance() {
+  static Logger logger;
+  return logger;
+}
+
+Logger::Logger() {
+  writer_ = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  wakeup_.notify_all();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+  for (auto& s : sinks_) {
+    ::close(s.second->fd);
+  }
+}
+
+void Logger::load(const std::string& path) {
+  std::ifstream f(path);
+  for (std::string line; std::getline(f, line);) {
+    std::istringstream in_stream(line);
+    std::string key;
+    in_stream >> key;
+    if (key == "level") {
+      std::string value;
+      in_stream >> value;
+      for (auto l : {LogLevel::kDebug, LogLevel::kInfo, LogLevel::kWarn, LogLevel::kError}) {
+        std::string name = level_name(l);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (value == name) {
+          set_level(l);
+        }
+      }
+    }
+    else if (key == "rotate_mb") {
+      int64_t mb;
+      if (in_stream >> mb && mb > 0) {
+        rotate_size_ = mb << 20;
+      }
+    }
+    else if (key == "rotate_keep") {
+      int keep;
+      if (in_stream >> keep && keep >= 0) {
+        rotate_keep_ = keep;
+      }
+    }
+  }
+}
+
+int Logger::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    std::cout << "Failed to open log [" << path << "]" << std::endl;
+    return -1;
+  }
+  auto sink = std::make_unique<Sink>();
+  sink->path = path;
+  sink->fd = fd;
+  sink->size = ::lseek(fd, 0, SEEK_END);
+  std::lock_guard<std::mutex> lock(lock_);
+  int id = next_sink_++;
+  sinks_.emplace(id, std::move(sink));
+  return id;
+}
+
+void Logger::close(int sink) {
+  Entry entry;
+  entry.sink = sink;
+  entry.close = true;
+  queue_.push(std::move(entry));
+  pushed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Logger::write(int sink, std::string&& text) {
+  Entry entry;
+  entry.sink = sink;
+  entry.text = std::move(text);
+  queue_.push(std::move(entry));
+  pushed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Logger::flush() {
+  std::unique_lock<std::mutex> lock(lock_);
+  uint64_t target = pushed_.load();
+  flush_requested_ = true;
+  wakeup_.notify_all();
+  flushed_.wait(lock, [this, target] { return written_ >= target; });
+}
+
+const std::string& Logger::timestamp() {
+  thread_local std::time_t last = 0;
+  thread_local std::string formatted;
+  std::time_t now = std::time(nullptr);
+  if (now != last) {
+    char res[20];
+    std::tm tm;
+    localtime_r(&now, &tm);
+    formatted.assign(res, std::strftime(res, sizeof(res), "%FT%T", &tm));
+    last = now;
+  }
+  return formatted;
+}
+
+void Logger::run() {
+  std::vector<Entry> batch;
+  for (;;) {
+    bool stop;
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      wakeup_.wait_for(lock, flushInterval, [this] { return stopping_ || flush_requested_; });
+      flush_requested_ = false;
+      stop = stopping_;
+    }
+
+    batch.clear();
+    queue_.drain(batch);
+    write_batch(batch);
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      written_ += batch.size();
+    }
+    flushed_.notify_all();
+
+    if (stop && queue_.empty()) {
+      return;
+    }
+  }
+}
+
+void Logger::write_batch(std::vector<Entry>& batch) {
+  // keeps the order of every sink's lines, writes each sink once
+  std::stable_sort(batch.begin(), batch.end(),
+    [](const Entry& a, const Entry& b) { return a.sink < b.sink; });
+  for (std::size_t begin = 0; begin < batch.size();) {
+    std::size_t end = begin;
+    while (end < batch.size() && batch[end].sink == batch[begin].sink) {
+      ++end;
+    }
+    Sink* sink = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      auto it = sinks_.find(batch[begin].sink);
+      if (it != sinks_.end()) {
+        sink = it->second.get();
+      }
+    }
+    if (sink != nullptr) {
+      write_sink(*sink, batch, begin, end);
+    }
+    begin = end;
+  }
+}
+
+void Logger::write_sink(Sink& sink, std::vector<Entry>& batch, std::size_t begin, std::size_t end) {
+  struct iovec iov[maxIov];
+  for (std::size_t i = begin; i < end;) {
+    int n = 0;
+    int64_t bytes = 0;
+    bool close = false;
+    for (; i < end && n < static_cast<int>(maxIov); ++i) {
+      if (batch[i].close) {
+        close = true;
+        ++i;
+        break;
+      }
+      iov[n].iov_base = &batch[i].text[0];
+      iov[n].iov_len = batch[i].text.size();
+      bytes += batch[i].text.size();
+      ++n;
+    }
+
+    int first = 0;
+    while (first < n) {
+      ssize_t written = ::writev(sink.fd, iov + first, n - first);
+      if (written < 0) {
+        break;
+      }
+      sink.size += written;
+      // skip what went out, a short write continues mid-line
+      while (first < n && static_cast<std::size_t>(written) >= iov[first].iov_len) {
+        written -= iov[first].iov_len;
+        ++first;
+      }
+      if (first < n) {
+        iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + written;
+        iov[first].iov_len -= written;
+      }
+    }
+
+    if (close) {
+      std::lock_guard<std::mutex> lock(lock_);
+      ::close(sink.fd);
+      sinks_.erase(batch[begin].sink);
+      return;
+    }
+    if (sink.size >= rotate_size_) {
+      rotate(sink);
+    }
+  }
+}
+
+void Logger::rotate(Sink& sink) {
+  int keep = rotate_keep_;
+  ::close(sink.fd);
+  if (keep == 0) {
+    ::unlink(sink.path.c_str());
+  }
+  for (int k = keep; k >= 1; --k) {
+    std::string from = k == 1 ? sink.path : sink.path + "." + std::to_string(k - 1);
+    std::string to = sink.path + "." + std::to_string(k);
+    std::rename(from.c_str(), to.c_str());
+  }
+  sink.fd = ::open(sink.path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  sink.size = 0;
+}
+
+LogLine::LogLine(Log* log, LogLevel level)
+  : log_(log->is_open() && level >= Logger::instance().level() ? log : nullptr) {
+  if (log_ != nullptr) {
+    text_.reserve(128);
+    text_ += Logger::timestamp();
+    text_ += ' ';
+    text_ += level_name(level);
+    text_ += ": ";
+  }
+}
+
+LogLine::~LogLine() {
+  if (log_ != nullptr) {
+    text_ += '\n';
+    Logger::instance().write(log_->sink_, std::move(text_));
+  }
+}
+
+void Log::close() {
+  if (sink_ >= 0) {
+    Logger::instance().close(sink_);
+    sink_ = -1;
+  }
+}
@@ -0,0 +1,307 @@
+#include "inc/metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace task_api;
+
+namespace {
+struct CounterInfo {
+  const char* name;
+  const char* help;
+};
+
+const CounterInfo counterInfo[Metrics::kCounters] = {
+  {"queries_sent_total", "Queries sent to TDLib"},
+  {"responses_total", "Responses received from TDLib"},
+  {"updates_total", "Updates received from TDLib"},
+  {"task_queued_total", "Responses and updates queued to tasks"},
+  {"task_handled_total", "Responses and updates handled by tasks"},
+  {"downloaded_bytes_total", "Bytes downloaded"},
+  {"files_downloaded_total", "Files downloaded"},
+  {"download_errors_total", "Failed downloads"},
+};
+
+double seconds(uint64_t us) {
+  return static_cast<double>(us) / 1e6;
+}
+}  // namespace
+
+Metrics& Metrics::instance() {
+  static Metrics metrics;
+  return metrics;
+}
+
+Metrics::~Metrics() {
+  stop_export();
+}
+
+void Metrics::Histogram::record(uint64_t us) {
+  std::size_t index;
+  if (us < (uint64_t(1) << subBits)) {
+    index = static_cast<std::size_t>(us);
+  }
+  else {
+    int e = std::min(static_cast<int>(std::bit_width(us)) - 1, maxExponent);
+    uint64_t sub = e == maxExponent && us >= (uint64_t(1) << (maxExponent + 1))
+      ? (uint64_t(1) << subBits) - 1
+      : (us >> (e - subBits)) & ((uint64_t(1) << subBits) - 1);
+    index = (static_cast<std::size_t>(e - subBits + 1) << subBits) | sub;
+  }
+  ++counts[index];
+  ++count;
+  sum_us += us;
+  max_us = std::max(max_us, us);
+}
+
+void Metrics::Histogram::merge(const Histogram& other) {
+  for (std::size_t i = 0; i < buckets; ++i) {
+    counts[i] += other.counts[i];
+  }
+  count += other.count;
+  sum_us += other.sum_us;
+  max_us = std::max(max_us, other.max_us);
+}
+
+uint64_t Metrics::Histogram::quantile(double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  // nearest rank
+  auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+  uint64_t seen = 0;
+  for (std::size_t i = 0; i < buckets; ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      if (i < (std::size_t(1) << subBits)) {
+        return std::min<uint64_t>(i, max_us);
+      }
+      int e = static_cast<int>(i >> subBits) + subBits - 1;
+      uint64_t sub = i & ((std::size_t(1) << subBits) - 1);
+      uint64_t upper = (((uint64_t(1) << subBits) + sub + 1) << (e - subBits));
+      return std::min(upper, max_us);
+    }
+  }
+  return max_us;
+}
+
+Metrics::Shard* Metrics::add_shard() {
+  auto shard = std::make_unique<Shard>();
+  Shard* result = shard.get();
+  std::lock_guard<std::mutex> lock(lock_);
+  shards_.push_back(std::move(shard));
+  return result;
+}
+
+void Metrics::name_type(int32_t type_id, std::string name) {
+  std::lock_guard<std::mutex> lock(lock_);
+  names_.emplace(type_id, std::move(name));
+}
+
+std::string Metrics::type_name(int32_t type_id) {
+  auto it = names_.find(type_id);
+  return it != names_.end() ? it->second : std::to_string(type_id);
+}
+
+std::string Metrics::query_name(int32_t type_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  return type_name(type_id);
+}
+
+void Metrics::query_latency(int32_t type_id, std::chrono::steady_clock::duration latency) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  Shard& s = shard();
+  std::lock_guard<std::mutex> lock(s.lock);
+  s.latencies[type_id].record(us > 0 ? static_cast<uint64_t>(us) : 0);
+}
+
+void Metrics::gauge(const std::string& name, std::function<int64_t()> read) {
+  std::lock_guard<std::mutex> lock(lock_);
+  gauges_[name] = std::move(read);
+}
+
+void Metrics::remove_gauge(const std::string& name) {
+  std::lock_guard<std::mutex> lock(lock_);
+  gauges_.erase(name);
+}
+
+int64_t Metrics::total(Counter counter) {
+  std::lock_guard<std::mutex> lock(lock_);
+  int64_t sum = 0;
+  for (auto& s : shards_) {
+    sum += s->counters[counter].load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+std::map<int32_t, Metrics::Histogram> Metrics::merged_latencies() {
+  std::map<int32_t, Histogram> merged;
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto& s : shards_) {
+    std::lock_guard<std::mutex> shard_lock(s->lock);
+    for (auto& h : s->latencies) {
+      merged[h.first].merge(h.second);
+    }
+  }
+  return merged;
+}
+
+std::map<std::string, std::function<int64_t()>> Metrics::gauges() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return gauges_;
+}
+
+void Metrics::print(std::ostream& out) {
+  int64_t sent = total(kQueriesSent);
+  int64_t responses = total(kResponses);
+  int64_t queued = total(kTaskQueued);
+  int64_t handled = total(kTaskHandled);
+  out << "Metrics: " << std::endl;
+  out << "  queries: " << sent << " sent, " << responses << " answered, "
+    << sent - responses << " in flight; " << total(kUpdates) << " updates" << std::endl;
+  out << "  task queues: " << queued - handled << " waiting (" << queued << " queued, "
+    << handled << " handled)" << std::endl;
+  out << "  downloads: " << total(kFilesDownloaded) << " files, "
+    << total(kBytesDownloaded) / (1024 * 1024) << " MB, " << total(kDownloadErrors)
+    << " errors" << std::endl;
+  for (auto& g : gauges()) {
+    out << "  " << g.first << ": " << g.second() << std::endl;
+  }
+
+  auto latencies = merged_latencies();
+  std::vector<std::pair<int32_t, const Histogram*>> order;
+  for (auto& h : latencies) {
+    order.emplace_back(h.first, &h.second);
+  }
+  // the busiest query types first
+  std::sort(order.begin(), order.end(),
+    [](const auto& a, const auto& b) { return a.second->count > b.second->count; });
+  out << "  query latency (ms): count p50 p90 p99 max" << std::endl;
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto& h : order) {
+    auto ms = [](uint64_t us) { return static_cast<double>(us) / 1000; };
+    out << "    " << std::left << std::setw(32) << type_name(h.first) << std::right
+      << " " << h.second->count << " " << ms(h.second->quantile(0.5))
+      << " " << ms(h.second->quantile(0.9)) << " " << ms(h.second->quantile(0.99))
+      << " " << ms(h.second->max_us) << std::endl;
+  }
+}
+
+void Metrics::write_prometheus(std::ostream& out) {
+  for (int c = 0; c < kCounters; ++c) {
+    out << "# HELP taskapi_" << counterInfo[c].name << " " << counterInfo[c].help << "\n"
+      << "# TYPE taskapi_" << counterInfo[c].name << " counter\n"
+      << "taskapi_" << counterInfo[c].name << " " << total(static_cast<Counter>(c)) << "\n";
+  }
+  out << "# HELP taskapi_queries_in_flight Queries sent and not answered yet\n"
+    << "# TYPE taskapi_queries_in_flight gauge\n"
+    << "taskapi_queries_in_flight " << total(kQueriesSent) - total(kResponses) << "\n";
+  out << "# HELP taskapi_task_queue_depth Responses and updates waiting in task queues\n"
+    << "# TYPE taskapi_task_queue_depth gauge\n"
+    << "taskapi_task_queue_depth " << total(kTaskQueued) - total(kTaskHandled) << "\n";
+  for (auto& g : gauges()) {
+    out << "# TYPE taskapi_" << g.first << " gauge\n"
+      << "taskapi_" << g.first << " " << g.second() << "\n";
+  }
+
+  auto latencies = merged_latencies();
+  out << "# HELP taskapi_query_latency_seconds From the send of a query to its handler\n"
+    << "# TYPE taskapi_query_latency_seconds summary\n";
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto& h : latencies) {
+    std::string labels = "type=\"" + type_name(h.first) + "\"";
+    for (double q : {0.5, 0.9, 0.99}) {
+      out << "taskapi_query_latency_seconds{" << labels << ",quantile=\"" << q << "\"} "
+        << seconds(h.second.quantile(q)) << "\n";
+    }
+    out << "taskapi_query_latency_seconds{" << labels << ",quantile=\"1\"} "
+      << seconds(h.second.max_us) << "\n";
+    out << "taskapi_query_latency_seconds_sum{" << labels << "} " << seconds(h.second.sum_us) << "\n"
+      << "taskapi_query_latency_seconds_count{" << labels << "} " << h.second.count << "\n";
+  }
+}
+
+void Metrics::load(const std::string& path) {
+  std::ifstream f(path);
+  for (std::string line; std::getline(f, line);) {
+    std::istringstream in_stream(line);
+    std::string key;
+    in_stream >> key;
+    if (key == "file") {
+      std::string file;
+      if (in_stream >> file) {
+        set_export_file(file);
+      }
+    }
+    else if (key == "interval") {
+      int64_t s;
+      if (in_stream >> s && s >= 0) {
+        std::lock_guard<std::mutex> lock(lock_);
+        export_interval_ = std::chrono::seconds(s);
+      }
+    }
+  }
+}
+
+void Metrics::set_export_file(const std::string& path) {
+  std::lock_guard<std::mutex> lock(lock_);
+  export_file_ = path;
+}
+
+void Metrics::start_export() {
+  std::lock_guard<std::mutex> lock(lock_);
+  // interval 0 turns the export off
+  if (exporter_.joinable() || export_file_.empty() || export_interval_.count() == 0) {
+    return;
+  }
+  stopping_ = false;
+  exporter_ = std::thread([this] {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!stop_cv_.wait_for(lock, export_interval_, [this] { return stopping_; })) {
+      lock.unlock();
+      write_file();
+      lock.lock();
+    }
+  });
+}
+
+void Metrics::stop_export() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  stop_cv_.notify_all();
+  if (exporter_.joinable()) {
+    exporter_.join();
+    // the last values are kept for the scraper
+    write_file();
+  }
+}
+
+void Metrics::write_file() {
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    path = export_file_;
+  }
+  std::ostringstream text;
+  write_prometheus(text);
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios_base::out | std::ios_base::trunc);
+    out << text.str();
+    if (!out.good()) {
+      std::cout << "Failed to write [" << tmp << "]" << std::endl;
+      return;
+    }
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::cout << "Failed to replace [" << path << "]" << std::endl;
+  }
+}
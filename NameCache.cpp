@@ -0,0 +1,236 @@
+#include "inc/name_cache.h"
+
+#include <algorithm>
+
+using namespace task_api;
+
+namespace {
+// heap bytes of a string, 0 while it fits in the small string buffer
+std::size_t heap_bytes(const std::string& s) {
+  return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+}
+}  // namespace
+
+void NameCache::set_limit(std::size_t entries) {
+  std::lock_guard<std::mutex> lock(lock_);
+  limit_ = entries;
+  while (limit_ > 0 && size_ > limit_) {
+    evict();
+  }
+}
+
+void NameCache::put(int64_t id, const std::string& first, const std::string& second) {
+  std::lock_guard<std::mutex> lock(lock_);
+  // the new names are interned before the old ones are released, so an
+  // unchanged name is not freed and copied again
+  uint32_t first_id = intern(first);
+  uint32_t second_id = intern(second);
+  std::size_t slot = slots_.empty() ? 0 : find(id);
+  if (!slots_.empty() && slots_[slot] != none) {
+    uint32_t index = slots_[slot];
+    Entry& e = entries_[index];
+    release(e.first);
+    release(e.second);
+    e.first = first_id;
+    e.second = second_id;
+    unlink(index);
+    push_front(index);
+    return;
+  }
+
+  if (limit_ > 0 && size_ >= limit_) {
+    evict();
+  }
+  if ((size_ + 1) * 4 > slots_.size() * 3) {
+    grow();
+  }
+  slot = find(id);
+  uint32_t index;
+  if (free_entry_ != none) {
+    index = free_entry_;
+    free_entry_ = entries_[index].next;
+  }
+  else {
+    index = static_cast<uint32_t>(entries_.size());
+    entries_.push_back(Entry());
+  }
+  entries_[index] = Entry{id, first_id, second_id, none, none};
+  slots_[slot] = index;
+  ++size_;
+  push_front(index);
+}
+
+bool NameCache::get(int64_t id, std::string& first, std::string& second) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (slots_.empty()) {
+    return false;
+  }
+  uint32_t index = slots_[find(id)];
+  if (index == none) {
+    return false;
+  }
+  first = strings_[entries_[index].first].text;
+  second = strings_[entries_[index].second].text;
+  if (limit_ > 0) {
+    unlink(index);
+    push_front(index);
+  }
+  return true;
+}
+
+std::size_t NameCache::size() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return size_;
+}
+
+std::size_t NameCache::strings() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return string_ids_.size();
+}
+
+std::size_t NameCache::evictions() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return evictions_;
+}
+
+std::size_t NameCache::memory() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  // an unordered_map node holds the value and a next pointer, plus a
+  // bucket pointer per bucket
+  std::size_t node = sizeof(std::pair<const std::string_view, uint32_t>) + sizeof(void*);
+  return entries_.capacity() * sizeof(Entry) +
+    slots_.capacity() * sizeof(uint32_t) +
+    strings_.size() * sizeof(Interned) +
+    free_strings_.capacity() * sizeof(uint32_t) +
+    string_ids_.bucket_count() * sizeof(void*) +
+    string_ids_.size() * node +
+    string_bytes_;
+}
+
+std::size_t NameCache::hash(int64_t id) {
+  uint64_t x = static_cast<uint64_t>(id);
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return static_cast<std::size_t>(x);
+}
+
+std::size_t NameCache::find(int64_t id) const {
+  std::size_t mask = slots_.size() - 1;
+  std::size_t slot = hash(id) & mask;
+  while (slots_[slot] != none && entries_[slots_[slot]].id != id) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void NameCache::erase_slot(std::size_t slot) {
+  // backward shift deletion: entries probing past the hole are moved into
+  // it, so lookups never stop at a false gap
+  std::size_t mask = slots_.size() - 1;
+  slots_[slot] = none;
+  std::size_t next = slot;
+  while (true) {
+    next = (next + 1) & mask;
+    if (slots_[next] == none) {
+      return;
+    }
+    std::size_t home = hash(entries_[slots_[next]].id) & mask;
+    // the entry stays when its home lies cyclically in (slot, next]
+    bool stays = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+    if (!stays) {
+      slots_[slot] = slots_[next];
+      slots_[next] = none;
+      slot = next;
+    }
+  }
+}
+
+void NameCache::grow() {
+  std::vector<uint32_t> old(std::max(initialSlots, slots_.size() * 2), none);
+  old.swap(slots_);
+  for (auto index : old) {
+    if (index != none) {
+      slots_[find(entries_[index].id)] = index;
+    }
+  }
+}
+
+void NameCache::unlink(uint32_t entry) {
+  Entry& e = entries_[entry];
+  if (e.prev != none) {
+    entries_[e.prev].next = e.next;
+  }
+  else {
+    head_ = e.next;
+  }
+  if (e.next != none) {
+    entries_[e.next].prev = e.prev;
+  }
+  else {
+    tail_ = e.prev;
+  }
+  e.prev = e.next = none;
+}
+
+void NameCache::push_front(uint32_t entry) {
+  Entry& e = entries_[entry];
+  e.prev = none;
+  e.next = head_;
+  if (head_ != none) {
+    entries_[head_].prev = entry;
+  }
+  head_ = entry;
+  if (tail_ == none) {
+    tail_ = entry;
+  }
+}
+
+void NameCache::evict() {
+  uint32_t index = tail_;
+  if (index == none) {
+    return;
+  }
+  erase_slot(find(entries_[index].id));
+  unlink(index);
+  release(entries_[index].first);
+  release(entries_[index].second);
+  entries_[index].next = free_entry_;
+  free_entry_ = index;
+  --size_;
+  ++evictions_;
+}
+
+uint32_t NameCache::intern(const std::string& text) {
+  auto it = string_ids_.find(std::string_view(text));
+  if (it != string_ids_.end()) {
+    ++strings_[it->second].refs;
+    return it->second;
+  }
+  uint32_t index;
+  if (!free_strings_.empty()) {
+    index = free_strings_.back();
+    free_strings_.pop_back();
+    strings_[index].text = text;
+  }
+  else {
+    index = static_cast<uint32_t>(strings_.size());
+    strings_.push_back(Interned{text, 0});
+  }
+  Interned& s = strings_[index];
+  s.refs = 1;
+  string_bytes_ += heap_bytes(s.text);
+  string_ids_.emplace(std::string_view(s.text), index);
+  return index;
+}
+
+void NameCache::release(uint32_t string) {
+  Interned& s = strings_[string];
+  if (--s.refs > 0) {
+    return;
+  }
+  string_ids_.erase(std::string_view(s.text));
+  string_bytes_ -= heap_bytes(s.text);
+  std::string().swap(s.text);
+  free_strings_.push_back(string);
+}
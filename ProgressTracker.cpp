@@ -0,0 +1,131 @@
+#include "inc/progress.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace task_api;
+
+constexpr std::chrono::seconds ProgressTracker::stallAfter;
+
+namespace {
+std::mutex trackersLock;
+std::vector<const ProgressTracker*> trackers;
+}  // namespace
+
+std::ostream& task_api::operator<<(std::ostream& out, const ProgressTotals& t) {
+  out << static_cast<int64_t>(t.rate / 1024) << " KB/s, " << t.remaining / 1024 << " KB left, eta ";
+  double eta = t.eta();
+  if (eta < 0) {
+    out << "unknown";
+  }
+  else {
+    out << static_cast<int64_t>(eta) << "s";
+  }
+  return out << ", " << t.files << " running, " << t.stalled << " stalled";
+}
+
+ProgressTracker::ProgressTracker() {
+  std::lock_guard<std::mutex> lock(trackersLock);
+  trackers.push_back(this);
+}
+
+ProgressTracker::~ProgressTracker() {
+  std::lock_guard<std::mutex> lock(trackersLock);
+  trackers.erase(std::remove(trackers.begin(), trackers.end(), this), trackers.end());
+}
+
+int64_t ProgressTracker::update(int32_t file_id, int64_t expected_size, int64_t downloaded_size) {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = files_.find(file_id);
+  if (it == files_.end()) {
+    it = files_.emplace(file_id, FileProgress()).first;
+    // a resumed download counts from where it was
+    it->second.downloaded = downloaded_size;
+    it->second.updated = now;
+  }
+  auto& p = it->second;
+  p.expected = std::max(expected_size, downloaded_size);
+  int64_t delta = downloaded_size - p.downloaded;
+  if (delta <= 0) {
+    return 0;
+  }
+
+  double dt = std::chrono::duration<double>(now - p.updated).count();
+  if (dt > 0) {
+    double alpha = 1 - std::exp(-dt / tau);
+    p.rate += alpha * (delta / dt - p.rate);
+  }
+  p.downloaded = downloaded_size;
+  p.updated = now;
+  downloaded_ += delta;
+  return delta;
+}
+
+void ProgressTracker::remove(int32_t file_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  files_.erase(file_id);
+}
+
+double ProgressTracker::current_rate(const FileProgress& p, std::chrono::steady_clock::time_point now) {
+  auto idle = now - p.updated;
+  if (idle < stallAfter) {
+    return p.rate;
+  }
+  return p.rate * std::exp(-std::chrono::duration<double>(idle).count() / tau);
+}
+
+ProgressTotals ProgressTracker::totals_locked(std::chrono::steady_clock::time_point now) const {
+  ProgressTotals t;
+  t.downloaded = downloaded_;
+  for (auto& f : files_) {
+    t.rate += current_rate(f.second, now);
+    t.remaining += f.second.expected - f.second.downloaded;
+    ++t.files;
+    if (now - f.second.updated >= stallAfter) {
+      ++t.stalled;
+    }
+  }
+  return t;
+}
+
+ProgressTotals ProgressTracker::totals() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return totals_locked(std::chrono::steady_clock::now());
+}
+
+void ProgressTracker::print(std::ostream& out) const {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto& f : files_) {
+    auto& p = f.second;
+    double rate = current_rate(p, now);
+    out << "    file id[" << f.first << "]: " << p.downloaded / 1024 << "/"
+      << p.expected / 1024 << " KB, " << static_cast<int64_t>(rate / 1024) << " KB/s";
+    if (rate > 0) {
+      out << ", eta " << static_cast<int64_t>((p.expected - p.downloaded) / rate) << "s";
+    }
+    if (now - p.updated >= stallAfter) {
+      out << ", stalled "
+        << std::chrono::duration_cast<std::chrono::seconds>(now - p.updated).count() << "s";
+    }
+    out << std::endl;
+  }
+}
+
+ProgressTotals ProgressTracker::global() {
+  auto now = std::chrono::steady_clock::now();
+  ProgressTotals sum;
+  std::lock_guard<std::mutex> lock(trackersLock);
+  for (auto tracker : trackers) {
+    std::lock_guard<std::mutex> tracker_lock(tracker->lock_);
+    auto t = tracker->totals_locked(now);
+    sum.rate += t.rate;
+    sum.downloaded += t.downloaded;
+    sum.remaining += t.remaining;
+    sum.files += t.files;
+    sum.stalled += t.stalled;
+  }
+  return sum;
+}
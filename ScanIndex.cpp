@@ -0,0 +1,152 @@
+#include "inc/scan_index.h"
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+using namespace task_api;
+
+namespace {
+std::mutex indexesLock;
+std::unordered_map<std::string, std::weak_ptr<ScanIndex>> indexes;
+}  // namespace
+
+std::shared_ptr<ScanIndex> ScanIndex::open(int64_t chat_id, const std::string& directory) {
+  std::string path = directory + "/" + std::to_string(chat_id) + "-scanned.idx";
+  std::lock_guard<std::mutex> lock(indexesLock);
+  auto& entry = indexes[path];
+  auto index = entry.lock();
+  if (!index) {
+    index.reset(new ScanIndex(path));
+    entry = index;
+  }
+  return index;
+}
+
+ScanIndex::ScanIndex(const std::string& path) : path_(path) {
+  load();
+  compact();
+}
+
+ScanIndex::~ScanIndex() {
+  if (journal_.is_open()) {
+    journal_.close();
+  }
+}
+
+void ScanIndex::load() {
+  std::ifstream f(path_);
+  for (std::string line; std::getline(f, line);) {
+    if (f.eof()) {
+      // no newline, the write was cut short
+      break;
+    }
+    std::istringstream in_stream(line);
+    char kind = 0;
+    in_stream >> kind;
+    if (kind == 'r') {
+      int64_t lo, hi;
+      if (in_stream >> lo >> hi && lo <= hi) {
+        insert(lo, hi);
+      }
+    }
+    else if (kind == 'f') {
+      int32_t id;
+      if (in_stream >> id) {
+        files_.insert(id);
+      }
+    }
+  }
+}
+
+void ScanIndex::insert(int64_t lo, int64_t hi) {
+  // merge with every range overlapping or touching [lo, hi]
+  auto it = ranges_.upper_bound(lo);
+  if (it != ranges_.begin() && std::prev(it)->second >= lo - 1) {
+    --it;
+  }
+  while (it != ranges_.end() && it->first <= hi + 1) {
+    lo = std::min(lo, it->first);
+    hi = std::max(hi, it->second);
+    it = ranges_.erase(it);
+  }
+  ranges_.emplace(lo, hi);
+}
+
+void ScanIndex::compact() {
+  if (journal_.is_open()) {
+    journal_.close();
+  }
+  std::string tmp = path_ + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios_base::out | std::ios_base::trunc);
+    for (auto& r : ranges_) {
+      out << "r " << r.first << " " << r.second << "\n";
+    }
+    for (auto id : files_) {
+      out << "f " << id << "\n";
+    }
+    out.flush();
+    if (!out) {
+      std::cout << "Failed to write [" << tmp << "]" << std::endl;
+    }
+  }
+  if (std::rename(tmp.c_str(), path_.c_str()) != 0) {
+    std::cout << "Failed to replace [" << path_ << "]" << std::endl;
+  }
+  journal_records_ = ranges_.size() + files_.size();
+  journal_.open(path_, std::ios_base::out | std::ios_base::app);
+}
+
+void ScanIndex::add_range(int64_t lo, int64_t hi) {
+  std::lock_guard<std::mutex> lock(lock_);
+  insert(lo, hi);
+  journal_ << "r " << lo << " " << hi << "\n" << std::flush;
+  if (++journal_records_ > 2 * (ranges_.size() + files_.size()) + compactAfter) {
+    compact();
+  }
+}
+
+void ScanIndex::add_file(int32_t file_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  claimed_.erase(file_id);
+  if (!files_.insert(file_id).second) {
+    return;
+  }
+  journal_ << "f " << file_id << "\n" << std::flush;
+  ++journal_records_;
+}
+
+bool ScanIndex::covered(int64_t msg_id, int64_t& lo, int64_t& hi) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = ranges_.upper_bound(msg_id);
+  if (it == ranges_.begin()) {
+    return false;
+  }
+  --it;
+  if (it->second < msg_id) {
+    return false;
+  }
+  lo = it->first;
+  hi = it->second;
+  return true;
+}
+
+bool ScanIndex::file_done(int32_t file_id) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return files_.find(file_id) != files_.end();
+}
+
+bool ScanIndex::claim_file(int32_t file_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (files_.find(file_id) != files_.end()) {
+    return false;
+  }
+  return claimed_.insert(file_id).second;
+}
+
+void ScanIndex::release_file(int32_t file_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  claimed_.erase(file_id);
+}
@@ -0,0 +1,364 @@
+#include "inc/search_index.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+#include "inc/text.h"
+
+using namespace task_api;
+
+namespace {
+const char searchMagic[8] = {'T', 'D', 'S', 'R', 'C', 'H', '0', '1'};
+
+void put_u64(std::string& buf, uint64_t v) {
+  while (v >= 0x80) {
+    buf.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  buf.push_back(static_cast<char>(v));
+}
+
+void put_i64(std::string& buf, int64_t v) {
+  put_u64(buf, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+
+class Reader {
+ public:
+  Reader(const char* p, const char* end) : p_(p), end_(end) {}
+
+  bool ok() const { return ok_; }
+  bool done() const { return p_ == end_; }
+  uint64_t u64() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p_ == end_) {
+        ok_ = false;
+        return 0;
+      }
+      auto byte = static_cast<uint8_t>(*p_++);
+      v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (byte < 0x80) {
+        return v;
+      }
+    }
+    ok_ = false;
+    return 0;
+  }
+  int64_t i64() {
+    uint64_t v = u64();
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+  }
+  std::string bytes(std::size_t n) {
+    if (static_cast<std::size_t>(end_ - p_) < n) {
+      ok_ = false;
+      p_ = end_;
+      return std::string();
+    }
+    std::string s(p_, n);
+    p_ += n;
+    return s;
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+  bool ok_{true};
+};
+
+uint64_t fnv(const char* p, std::size_t n) {
+  uint64_t h = 14695981039346656037ull;
+  for (std::size_t i = 0; i < n; ++i) {
+    h = (h ^ static_cast<unsigned char>(p[i])) * 1099511628211ull;
+  }
+  return h;
+}
+
+uint64_t message_key(int64_t chat_id, int64_t msg_id) {
+  // splitmix64 finalizer over both ids
+  uint64_t h = static_cast<uint64_t>(chat_id) * 0x9e3779b97f4a7c15ull ^ static_cast<uint64_t>(msg_id);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  return h ^ (h >> 31);
+}
+
+// hashes of the distinct terms of text, sorted
+std::vector<uint64_t> terms_of(const std::string& text) {
+  std::vector<uint64_t> terms;
+  std::string word;
+  auto flush = [&terms, &word] {
+    if (!word.empty()) {
+      terms.push_back(fnv(word.data(), word.size()));
+      word.clear();
+    }
+  };
+  for (std::size_t i = 0; i < text.size();) {
+    unsigned char c = text[i];
+    if (c < 0x80) {
+      if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')) {
+        word.push_back(static_cast<char>(c));
+      }
+      else if (c >= 'A' && c <= 'Z') {
+        word.push_back(static_cast<char>(c - 'A' + 'a'));
+      }
+      else {
+        flush();
+      }
+      ++i;
+      continue;
+    }
+    // one term per multi-byte UTF-8 character
+    flush();
+    std::size_t n = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+    n = std::min(n, text.size() - i);
+    terms.push_back(fnv(text.data() + i, n));
+    i += n;
+  }
+  flush();
+  std::sort(terms.begin(), terms.end());
+  terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+  return terms;
+}
+
+std::string snippet_of(const std::string& text, std::size_t length) {
+  std::size_t n = std::min(length, text.size());
+  // don't cut a UTF-8 sequence
+  while (n < text.size() && n > 0 && (static_cast<unsigned char>(text[n]) & 0xc0) == 0x80) {
+    --n;
+  }
+  std::string s = text.substr(0, n);
+  normalize_text(s, true);
+  return s;
+}
+
+bool read_file(const std::string& path, std::string& data) {
+  std::ifstream f(path, std::ios_base::binary);
+  if (!f.is_open()) {
+    return false;
+  }
+  data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  return true;
+}
+}  // namespace
+
+std::string& SearchIndex::directory() {
+  static std::string directory("tdlib");
+  return directory;
+}
+
+void SearchIndex::set_directory(const std::string& directory) {
+  SearchIndex::directory() = directory;
+}
+
+SearchIndex& SearchIndex::instance() {
+  static SearchIndex index(directory() + "/search.idx", directory() + "/search.log");
+  return index;
+}
+
+SearchIndex::SearchIndex(const std::string& snapshot_path, const std::string& journal_path)
+  : snapshot_path_(snapshot_path), journal_path_(journal_path) {
+  load();
+  // load() has reopened it already when it dropped a torn record
+  if (!journal_.is_open()) {
+    journal_.open(journal_path_, std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+  }
+}
+
+SearchIndex::~SearchIndex() {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (journal_records_ > 0) {
+    write_snapshot();
+  }
+}
+
+void SearchIndex::load() {
+  std::string data;
+  if (read_file(snapshot_path_, data) && data.size() >= sizeof(searchMagic) &&
+    std::memcmp(data.data(), searchMagic, sizeof(searchMagic)) == 0) {
+    Reader r(data.data() + sizeof(searchMagic), data.data() + data.size());
+    uint64_t docs = r.u64();
+    for (uint64_t i = 0; i < docs && r.ok(); ++i) {
+      Document d;
+      d.chat_id = r.i64();
+      d.msg_id = r.i64();
+      d.snippet = r.bytes(r.u64());
+      documents_.push_back(std::move(d));
+    }
+    uint64_t terms = r.u64();
+    for (uint64_t i = 0; i < terms && r.ok(); ++i) {
+      uint64_t term = r.u64();
+      Postings& p = terms_[term];
+      p.count = static_cast<uint32_t>(r.u64());
+      p.last = static_cast<uint32_t>(r.u64());
+      p.deltas = r.bytes(r.u64());
+    }
+    if (!r.ok()) {
+      std::cout << "[" << snapshot_path_ << "] is damaged, dropping it: only messages in ["
+        << journal_path_ << "] and indexed from now on will be found" << std::endl;
+      documents_.clear();
+      terms_.clear();
+    }
+    for (auto& d : documents_) {
+      messages_.insert(message_key(d.chat_id, d.msg_id));
+    }
+  }
+
+  // a torn last record is dropped
+  if (read_file(journal_path_, data)) {
+    Reader r(data.data(), data.data() + data.size());
+    while (!r.done()) {
+      int64_t chat_id = r.i64();
+      int64_t msg_id = r.i64();
+      std::string text = r.bytes(r.u64());
+      if (!r.ok()) {
+        // later records must not follow the torn one
+        write_snapshot();
+        break;
+      }
+      index(chat_id, msg_id, text);
+      ++journal_records_;
+    }
+  }
+}
+
+void SearchIndex::add(int64_t chat_id, int64_t msg_id, const std::string& text) {
+  if (text.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!index(chat_id, msg_id, text)) {
+    return;
+  }
+  std::string record;
+  put_i64(record, chat_id);
+  put_i64(record, msg_id);
+  put_u64(record, text.size());
+  record.append(text);
+  journal_.write(record.data(), record.size());
+  journal_.flush();
+  if (++journal_records_ >= snapshotAfter) {
+    write_snapshot();
+  }
+}
+
+bool SearchIndex::index(int64_t chat_id, int64_t msg_id, const std::string& text) {
+  if (!messages_.insert(message_key(chat_id, msg_id)).second) {
+    return false;
+  }
+  documents_.push_back(Document{chat_id, msg_id, snippet_of(text, snippetLength)});
+  auto doc = static_cast<uint32_t>(documents_.size());
+  for (auto term : terms_of(text)) {
+    Postings& p = terms_[term];
+    put_u64(p.deltas, doc - p.last);
+    p.last = doc;
+    ++p.count;
+  }
+  return true;
+}
+
+void SearchIndex::write_snapshot() {
+  std::string buf(searchMagic, sizeof(searchMagic));
+  put_u64(buf, documents_.size());
+  for (auto& d : documents_) {
+    put_i64(buf, d.chat_id);
+    put_i64(buf, d.msg_id);
+    put_u64(buf, d.snippet.size());
+    buf.append(d.snippet);
+  }
+  // sorted, so equal indexes produce equal files
+  std::vector<uint64_t> order;
+  order.reserve(terms_.size());
+  for (auto& t : terms_) {
+    order.push_back(t.first);
+  }
+  std::sort(order.begin(), order.end());
+  put_u64(buf, order.size());
+  for (auto term : order) {
+    const Postings& p = terms_[term];
+    put_u64(buf, term);
+    put_u64(buf, p.count);
+    put_u64(buf, p.last);
+    put_u64(buf, p.deltas.size());
+    buf.append(p.deltas);
+  }
+
+  std::string tmp = snapshot_path_ + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+    out.write(buf.data(), buf.size());
+    if (!out.good()) {
+      std::cout << "Failed to write [" << tmp << "]" << std::endl;
+      return;
+    }
+  }
+  if (std::rename(tmp.c_str(), snapshot_path_.c_str()) != 0) {
+    std::cout << "Failed to replace [" << snapshot_path_ << "]" << std::endl;
+    return;
+  }
+  // documents replayed twice after a crash here are skipped by messages_
+  if (journal_.is_open()) {
+    journal_.close();
+  }
+  journal_.open(journal_path_, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+  journal_records_ = 0;
+}
+
+void SearchIndex::decode(const Postings& postings, std::vector<uint32_t>& out) {
+  out.clear();
+  out.reserve(postings.count);
+  Reader r(postings.deltas.data(), postings.deltas.data() + postings.deltas.size());
+  uint32_t doc = 0;
+  while (!r.done() && r.ok()) {
+    doc += static_cast<uint32_t>(r.u64());
+    out.push_back(doc);
+  }
+}
+
+std::vector<SearchIndex::Hit> SearchIndex::search(const std::string& query, std::size_t limit, int64_t chat_id) {
+  std::vector<Hit> hits;
+  auto terms = terms_of(query);
+  if (terms.empty() || limit == 0) {
+    return hits;
+  }
+  std::lock_guard<std::mutex> lock(lock_);
+  std::vector<const Postings*> lists;
+  for (auto term : terms) {
+    auto it = terms_.find(term);
+    if (it == terms_.end()) {
+      return hits;
+    }
+    lists.push_back(&it->second);
+  }
+  // intersect from the shortest list, so the candidates only shrink
+  std::sort(lists.begin(), lists.end(),
+    [](const Postings* a, const Postings* b) { return a->count < b->count; });
+  std::vector<uint32_t> docs, next, merged;
+  decode(*lists[0], docs);
+  for (std::size_t i = 1; i < lists.size() && !docs.empty(); ++i) {
+    decode(*lists[i], next);
+    merged.clear();
+    std::set_intersection(docs.begin(), docs.end(), next.begin(), next.end(),
+      std::back_inserter(merged));
+    docs.swap(merged);
+  }
+
+  for (auto it = docs.rbegin(); it != docs.rend() && hits.size() < limit; ++it) {
+    const Document& d = documents_[*it - 1];
+    if (chat_id == 0 || d.chat_id == chat_id) {
+      hits.push_back(Hit{d.chat_id, d.msg_id, d.snippet});
+    }
+  }
+  return hits;
+}
+
+std::size_t SearchIndex::documents() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return documents_.size();
+}
+
+std::size_t SearchIndex::terms() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return terms_.size();
+}
@@ -6,51 +6,41 @@
 
 using namespace task_api;
 
-std::unordered_map<int64_t, std::vector<std::string>> FileNamesLookUp;
+ExclusionEngine Exclusions;
 std::unordered_set<int64_t> SuppressedChats;
+ConcurrencyConfig ConcurrencyLimits;
 
-void replace_char(std::string& s, char c1, char c2) {
-  size_t pos = s.find(c1, 0);
-  while (pos != std::string::npos) {
-    s.replace(pos, 1, 1, c2);
-    pos = s.find(c1, pos + 1);
+TdMain::TdMain(std::unique_ptr<Transport> transport) : TdTask(nullptr) {
+  // database directories of the accounts to run, the first one is primary
+  std::vector<std::string> accounts;
+  std::ifstream a("./accounts.ini");
+  if (a.is_open()) {
+    for (std::string directory; a >> directory;) {
+      accounts.push_back(directory);
+    }
+    a.close();
   }
-}
-
-void clean_text(std::string& s) {
-  replace_char(s, '[', '(');
-  replace_char(s, ']', ')');
-}
-
-TdMain::TdMain() : TdTask(nullptr) {
-  client_ptr_ = new ClientWrapper();
+  if (accounts.empty()) {
+    accounts.push_back("tdlib");
+  }
+  client_ptr_ = new ClientWrapper(std::move(transport), accounts);
+  // process-wide state lives with the primary account
+  DedupIndex::set_directory(client_ptr_->database_directory(0));
+  SearchIndex::set_directory(client_ptr_->database_directory(0));
 
-  client_ptr_->subscribe_update(td_api::updateNewChat::ID, this);
-  client_ptr_->subscribe_update(td_api::updateChatTitle::ID, this);
-  client_ptr_->subscribe_update(td_api::updateUser::ID, this);
+  for (std::int32_t account = 0; account < client_ptr_->accounts(); ++account) {
+    client_ptr_->subscribe_update(td_api::updateNewChat::ID, this, account);
+    client_ptr_->subscribe_update(td_api::updateChatTitle::ID, this, account);
+    client_ptr_->subscribe_update(td_api::updateUser::ID, this, account);
+  }
+  // new messages are printed once, from the primary account
   client_ptr_->subscribe_update(td_api::updateNewMessage::ID, this);
 
   launch_task(client_ptr_);
 
-  std::ifstream f("./exclusion.ini");
-  if (f.is_open()) {
-    char line[100];
-    while (f.getline(line, 100)) {
-      std::string s(line);
-      std::istringstream in_stream(s);
-      int64_t chatId;
-      std::vector<std::string> fileNames;
-      in_stream >> chatId;
-      for (std::string n; in_stream >> n;) {
-        fileNames.push_back(n);
-      }
-      FileNamesLookUp.emplace(std::make_pair(chatId, fileNames));
-    }
+  Exclusions.load("./exclusion.ini");
 
-    f.close();
-  }
-
-  f.open("./msg_suppress.ini");
+  std::ifstream f("./msg_suppress.ini");
   if (f.is_open()) {
     for(std::int64_t id; f >> id;) {
       SuppressedChats.insert(id);
@@ -58,6 +48,41 @@ TdMain::TdMain() : TdTask(nullptr) {
     f.close();
   }
 
+  // "users <n>" / "chats <n>" bound the name caches, 0 or missing keeps all
+  std::ifstream c("./cache.ini");
+  if (c.is_open()) {
+    std::string key;
+    std::size_t entries;
+    while (c >> key >> entries) {
+      if (key == "users") {
+        users_.set_limit(entries);
+      }
+      else if (key == "chats") {
+        chat_title_.set_limit(entries);
+      }
+    }
+    c.close();
+  }
+
+  chat_snapshot_.reset(new ChatSnapshot(client_ptr_->database_directory(0) + "/chats.snap"));
+  chat_snapshot_->for_each([this](std::int64_t chat_id, const std::string& title) {
+    chat_title_.put(chat_id, title);
+  });
+
+  ConcurrencyLimits.load("./concurrency.ini");
+  Logger::instance().load("./logging.ini");
+
+  Metrics& metrics = Metrics::instance();
+  metrics.set_export_file(client_ptr_->database_directory(0) + "/metrics.prom");
+  metrics.load("./metrics.ini");
+  metrics.gauge("executor_queued_tasks",
+    [this] { return static_cast<std::int64_t>(executor_.queued()); });
+  metrics.gauge("download_slots_used", [] { return DownloadScheduler::instance().running(); });
+  metrics.gauge("download_slots_cap", [] { return DownloadScheduler::instance().cap(); });
+  metrics.gauge("download_tickets_waiting",
+    [] { return static_cast<std::int64_t>(DownloadScheduler::instance().waiting()); });
+  metrics.start_export();
+
   send_query(td_api::make_object<td_api::setLogVerbosityLevel>(0), [this](Object o){});
   /*
   std::cout << "exclusionlist size: " << FILE_NAMES_LOOKUP.size() << std::endl;
@@ -75,6 +100,9 @@ TdMain::TdMain() : TdTask(nullptr) {
 }
 
 TdMain::~TdMain() {
+  // the gauges read executor_
+  Metrics::instance().stop_export();
+  Metrics::instance().remove_gauge("executor_queued_tasks");
   for (auto it : task_handles_) {
     delete it;
   }
@@ -82,187 +110,329 @@ TdMain::~TdMain() {
 
 void TdMain::run() {
   while (true) {
+    // TdMain's responses and updates are handled as they arrive; handlers
+    // may have printed over the prompt
+    if (process_responses() > 0 && console_started_) {
+      print_prompt();
+    }
     if (client_ptr_->need_restart()) {
       std::cout << "Authorization state has changed, please restart the app, "
         << std::endl;
       terminate();
       return;
     }
-    else if (!client_ptr_->authenticated()) {
-      std::this_thread::sleep_for(std::chrono::seconds(5));
+    if (!console_started_ && client_ptr_->authenticated()) {
+      // ClientWrapper reads stdin itself until every account is authorized
+      console_started_ = true;
+      for (std::int32_t account = 0; account < client_ptr_->accounts(); ++account) {
+        schedule_task(new ChatLoader(client_ptr_, account));
+      }
+      print_help();
+      // blocked in getline, it can't be joined; it stops after "q"
+      std::thread([this] { read_console(); }).detach();
+      print_prompt();
+    }
 
+    std::deque<std::string> lines;
+    {
+      std::lock_guard<std::mutex> lock(console_lock_);
+      lines.swap(console_lines_);
     }
-    else {
-      std::cout << "Enter action [q] quit [u] check for updates and request "
-        "results [c] show chats [me] show self [ad <chat_id> "
-        "<from_msg_id> <limit>] download from chat [l] logout: "
-        << std::endl;
-      std::string line;
-      std::getline(std::cin, line);
-      std::istringstream ss(line);
-      std::string action;
-      if (!(ss >> action)) {
-        continue;
-      }
-      if (action == "q") {
+    for (auto& line : lines) {
+      if (!handle_command(line)) {
         terminate();
         return;
       }
-      if (action == "stop") {
-        std::cout << "Stopping downloading thread...";
-        this->stop_tasks(false);
-        std::cout << "Done!" << std::endl;
-      }
-      if (action == "u") {
-        std::cout << "Checking for updates..." << std::endl;
-        process_responses();
-      }
-      else if (action == "close") {
-        std::cout << "Closing..." << std::endl;
-        send_query(td_api::make_object<td_api::close>(), {});
-      }
-      else if (action == "me") {
-        send_query(td_api::make_object<td_api::getMe>(), [this](Object object) {
-          std::cout << to_string(object) << std::endl;
-          });
-      }
-      else if (action == "l") {
-        std::cout << "Logging out..." << std::endl;
-        send_query(td_api::make_object<td_api::logOut>(), {});
-      }
-      else if (action == "c") {
-        std::cout << "Loading chat list..." << std::endl;
-        send_query(td_api::make_object<td_api::getChats>(nullptr, 100),
-          [this](Object object) {
-            if (object->get_id() == td_api::error::ID) {
-              return;
-            }
-            auto chats = td::move_tl_object_as<td_api::chats>(object);
-            for (auto chat_id : chats->chat_ids_) {
-              std::cout << "[chat_id:" << chat_id
-                << "] [title:" << chat_title_[chat_id] << "]"
-                << std::endl;
-            }
-          });
+      print_prompt();
+    }
+    wait_for_responses(std::chrono::steady_clock::now() + authPollInterval);
+  }
+}
+
+void TdMain::read_console() {
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream ss(line);
+    std::string action;
+    ss >> action;
+    {
+      std::lock_guard<std::mutex> lock(console_lock_);
+      console_lines_.push_back(line);
+    }
+    wake();
+    if (action == "q") {
+      return;
+    }
+  }
+  // the end of the input quits
+  {
+    std::lock_guard<std::mutex> lock(console_lock_);
+    console_lines_.push_back("q");
+  }
+  wake();
+}
+
+void TdMain::print_help() {
+  std::cout << "Actions: [q] quit [h] help [c] show chats [me] show self [ad <chat_id> "
+    "<from_msg_id> <limit> <direction> [weight] [priority] [account]] download from chat "
+    "[ex <chat_id> <file> [from_msg_id] [limit]] export history [status] show cache status "
+    "[stats] show metrics [trace on|off [file]] record a Chrome trace "
+    "[lse <limit> <words>] search the local index [l] logout: "
+    << std::endl;
+}
+
+bool TdMain::handle_command(const std::string& line) {
+  std::istringstream ss(line);
+  std::string action;
+  if (!(ss >> action)) {
+    return true;
+  }
+  if (action == "q") {
+    return false;
+  }
+  if (action == "stop") {
+    std::cout << "Stopping downloading thread...";
+    this->stop_tasks(false);
+    std::cout << "Done!" << std::endl;
+  }
+  if (action == "h") {
+    print_help();
+  }
+  else if (action == "u") {
+    // responses are handled as they arrive, this only catches up early
+    process_responses();
+  }
+  else if (action == "close") {
+    std::cout << "Closing..." << std::endl;
+    send_query(td_api::make_object<td_api::close>(), {});
+  }
+  else if (action == "me") {
+    send_query(td_api::make_object<td_api::getMe>(), [this](Object object) {
+      std::cout << to_string(object) << std::endl;
+      });
+  }
+  else if (action == "l") {
+    std::cout << "Logging out..." << std::endl;
+    send_query(td_api::make_object<td_api::logOut>(), {});
+  }
+  else if (action == "c") {
+    std::cout << "Loading chat list..." << std::endl;
+    send_query(td_api::make_object<td_api::getChats>(nullptr, 100),
+      [this](Object object) {
+        if (object->get_id() == td_api::error::ID) {
+          return;
+        }
+        auto chats = td::move_tl_object_as<td_api::chats>(object);
+        for (auto chat_id : chats->chat_ids_) {
+          std::cout << "[chat_id:" << chat_id
+            << "] [title:" << get_chat_title(chat_id) << "]"
+            << std::endl;
+        }
+      });
+  }
+  else if (action == "ls") {
+    std::int64_t chat_id, from_msg_id, offset, limit;
+    ss >> chat_id;
+    ss >> from_msg_id;
+    ss >> offset;
+    ss >> limit;
+    std::cout << "List messages from chat [" << chat_id << "] ..."
+      << std::endl;
+    send_query(
+      td_api::make_object<td_api::getChatHistory>(chat_id, from_msg_id,
+        offset, limit, false),
+      [this](Object object) {
+        if (object->get_id() == td_api::error::ID) {
+          auto&& e = td::move_tl_object_as<td_api::error>(object);
+          std::cout << "Error getting chat history: " << e->message_
+            << std::endl;
+          return;
+        }
+
+        // if (object->get_id() == td_api::messages::ID) {
+        //   std::cout << "Correct response object" << std::endl;
+        // }
+        // auto& messages = (static_cast<td_api::messages
+        // &>(*object)).messages_;
+        auto msptr = td::move_tl_object_as<td_api::messages>(object);
+        std::vector<td_api::object_ptr<td_api::message>>& messages =
+          msptr->messages_;
+        std::cout << "Print messages: "
+          << "total[" << messages.size() << "]" << std::endl;
+        for (auto mptr = messages.begin(); mptr != messages.end();
+          ++mptr) {
+          print_msg(*mptr);
+          // std::cout << "message : " << m->get_id() << " " <<
+          // m->content_->get_id() << std::endl;
+        }
+      });
+  }
+  else if (action == "getMsg") {
+    std::int64_t chat_id, message_id;
+    ss >> chat_id;
+    ss >> message_id;
+    std::cout << "Show message [" << message_id << "] from chat ["
+      << chat_id << "]..." << std::endl;
+    send_query(td_api::make_object<td_api::getMessage>(chat_id, message_id),
+      [this](Object object) {
+        if (object->get_id() == td_api::error::ID) {
+          auto&& e = td::move_tl_object_as<td_api::error>(object);
+          std::cout << "Error showing message: " << e->message_
+            << std::endl;
+          return;
+        }
+
+        auto m = td::move_tl_object_as<td_api::message>(object);
+        print_msg(m);
+      });
+  }
+  else if (action == "ad") {
+    std::int64_t chat_id = 0, starting_message_id = 0;
+    std::int32_t limit = 0, direction = 0, weight = 1, priority = 0, account = -1;
+    ss >> chat_id;
+    ss >> starting_message_id;
+    ss >> limit;
+    ss >> direction;
+    ss >> weight;
+    ss >> priority;
+    ss >> account;
+    direction = direction > 0 ? 1 : -1;
+    if (account < 0 || account >= client_ptr_->accounts()) {
+      account = pick_account(chat_id);
+    }
+    std::cout << "Auto downloading from chat [id: " << chat_id
+      << ", title:" << get_chat_title(chat_id) << "], starting from message [" << starting_message_id
+      << "], max to download: [" << limit << "], weight: [" << weight
+      << "], priority: [" << priority << "], account: ["
+      << client_ptr_->database_directory(account) << "]." << std::endl;
+
+    Downloader* downloader = new Downloader(chat_id, get_chat_title(chat_id), starting_message_id,
+      limit, direction, client_ptr_, weight, priority, account);
+    schedule_task(downloader);
+  }
+  else if (action == "ex") {
+    std::int64_t chat_id = 0, from_msg_id = 0, limit = 0;
+    std::string path;
+    ss >> chat_id;
+    ss >> path;
+    ss >> from_msg_id;
+    ss >> limit;
+    if (path.empty()) {
+      std::cout << "Usage: ex <chat_id> <file> [from_msg_id] [limit]" << std::endl;
+      return true;
+    }
+    std::cout << "Exporting chat [id: " << chat_id << ", title:" << get_chat_title(chat_id)
+      << "] to [" << path << "]..." << std::endl;
+    schedule_task(new HistoryExporter(chat_id, path, from_msg_id, limit, client_ptr_,
+      pick_account(chat_id)));
+  }
+  else if (action == "lse") {
+    std::size_t limit = 0;
+    ss >> limit;
+    std::string query;
+    std::getline(ss, query);
+    auto started = std::chrono::steady_clock::now();
+    auto hits = SearchIndex::instance().search(query, limit > 0 ? limit : 100);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    for (auto& hit : hits) {
+      std::cout << "[chat_id:" << hit.chat_id << "] [title:" << get_chat_title(hit.chat_id)
+        << "] msg[" << hit.msg_id << "] :" << hit.snippet << std::endl;
+    }
+    std::cout << "Local search results: [" << hits.size() << "] in " << ms << " ms" << std::endl;
+  }
+  else if (action == "status") {
+    print_status();
+  }
+  else if (action == "stats") {
+    client_ptr_->print_status();
+    Metrics::instance().print(std::cout);
+  }
+  else if (action == "trace") {
+    std::string mode, path;
+    ss >> mode;
+    ss >> path;
+    if (mode == "on") {
+      Tracer::instance().start();
+      std::cout << "Tracing queries and downloads..." << std::endl;
+    }
+    else if (mode == "off") {
+      if (path.empty()) {
+        path = client_ptr_->database_directory(0) + "/trace.json";
       }
-      else if (action == "ls") {
-        std::int64_t chat_id, from_msg_id, offset, limit;
-        ss >> chat_id;
-        ss >> from_msg_id;
-        ss >> offset;
-        ss >> limit;
-        std::cout << "List messages from chat [" << chat_id << "] ..."
-          << std::endl;
-        send_query(
-          td_api::make_object<td_api::getChatHistory>(chat_id, from_msg_id,
-            offset, limit, false),
-          [this](Object object) {
-            if (object->get_id() == td_api::error::ID) {
-              auto&& e = td::move_tl_object_as<td_api::error>(object);
-              std::cout << "Error getting chat history: " << e->message_
-                << std::endl;
-              return;
-            }
-
-            // if (object->get_id() == td_api::messages::ID) {
-            //   std::cout << "Correct response object" << std::endl;
-            // }
-            // auto& messages = (static_cast<td_api::messages
-            // &>(*object)).messages_;
-            auto msptr = td::move_tl_object_as<td_api::messages>(object);
-            std::vector<td_api::object_ptr<td_api::message>>& messages =
-              msptr->messages_;
-            std::cout << "Print messages: "
-              << "total[" << messages.size() << "]" << std::endl;
-            for (auto mptr = messages.begin(); mptr != messages.end();
-              ++mptr) {
-              print_msg(*mptr);
-              // std::cout << "message : " << m->get_id() << " " <<
-              // m->content_->get_id() << std::endl;
-            }
-          });
+      auto spans = Tracer::instance().stop(path);
+      if (spans < 0) {
+        std::cout << "Failed to write the trace to [" << path << "]" << std::endl;
       }
-      else if (action == "getMsg") {
-        std::int64_t chat_id, message_id;
-        ss >> chat_id;
-        ss >> message_id;
-        std::cout << "Show message [" << message_id << "] from chat ["
-          << chat_id << "]..." << std::endl;
-        send_query(td_api::make_object<td_api::getMessage>(chat_id, message_id),
-          [this](Object object) {
-            if (object->get_id() == td_api::error::ID) {
-              auto&& e = td::move_tl_object_as<td_api::error>(object);
-              std::cout << "Error showing message: " << e->message_
-                << std::endl;
-              return;
-            }
-
-            auto m = td::move_tl_object_as<td_api::message>(object);
-            print_msg(m);
-          });
+      else {
+        std::cout << "Wrote [" << spans << "] spans to [" << path
+          << "], open it in chrome://tracing or ui.perfetto.dev" << std::endl;
       }
-      else if (action == "ad") {
-        std::int64_t chat_id = 0, starting_message_id = 0;
-        std::int32_t limit = 0, direction = 0;
-        ss >> chat_id;
-        ss >> starting_message_id;
-        ss >> limit;
-        ss >> direction;
-        direction = direction > 0 ? 1 : -1;
-        std::cout << "Auto downloading from chat [id: " << chat_id
-          << ", title:" << chat_title_[chat_id] << "], starting from message [" << starting_message_id
-          << "], max to download: [" << limit << "]." << std::endl;
-
-        Downloader* downloader = new Downloader(chat_id, chat_title_[chat_id], starting_message_id,
-          limit, direction, client_ptr_);
-        launch_task(downloader);
+    }
+    else {
+      std::cout << "Usage: trace on|off [file]" << std::endl;
+    }
+  }
+  else if (action == "dstatus") {
+    if (task_handles_.size() > 1) {
+      // print the most recent one in the last
+      for (auto it = task_handles_.begin() + 1; it < task_handles_.end(); ++it) {
+        (*it)->print_status();
       }
-      else if (action == "dstatus") {
-        if (task_handles_.size() > 1) {
-          // print the most recent one in the last
-          for (auto it = task_handles_.begin() + 1; it < task_handles_.end(); ++it) {
-            (*it)->print_status();
-          }
-        }
-        else {
-          std::cout << "No downloader was created so far..." << std::endl;
-        }
+      std::cout << "All downloads: " << ProgressTracker::global() << std::endl;
+      DownloadScheduler::instance().print_status(std::cout);
+    }
+    else {
+      std::cout << "No downloader was created so far..." << std::endl;
+    }
+  }
+  else if (action == "se") {
+    std::int64_t chat_id = 0;
+    std::string query;
+    std::int32_t video_and_photo_only;
+    std::int32_t limit = 100;
+
+    ss >> chat_id;
+    ss >> query;
+    ss >> video_and_photo_only;
+    ss >> limit;
+
+    std::cout << "Searching for messages in chat[" << chat_id
+    << "], title[" << get_chat_title(chat_id) << "], query: ["
+    << query << "], video and photo only: " << video_and_photo_only
+    << " limit: " << limit << std::endl;
+
+    send_query(td_api::make_object<td_api::searchChatMessages>(chat_id, query, nullptr, 0, 0, limit > 100 ? 100 : limit,
+                                                               video_and_photo_only > 0 ? td_api::make_object<td_api::searchMessagesFilterPhotoAndVideo>() : nullptr, 0, 0),
+               [this](Object object) {
+      if (object->get_id() == td_api::error::ID) {
+        auto&& e = td::move_tl_object_as<td_api::error>(object);
+        std::cout << "Error searching for messages: " << e->message_
+        << std::endl;
+        return;
       }
-      else if (action == "se") {
-        std::int64_t chat_id = 0;
-        std::string query;
-        std::int32_t video_and_photo_only;
-        std::int32_t limit = 100;
-
-        ss >> chat_id;
-        ss >> query;
-        ss >> video_and_photo_only;
-        ss >> limit;
-
-        std::cout << "Searching for messages in chat[" << chat_id
-        << "], title[" << chat_title_[chat_id] << "], query: ["
-        << query << "], video and photo only: " << video_and_photo_only
-        << " limit: " << limit << std::endl;
-
-        send_query(td_api::make_object<td_api::searchChatMessages>(chat_id, query, nullptr, 0, 0, limit > 100 ? 100 : limit,
-                                                                   video_and_photo_only > 0 ? td_api::make_object<td_api::searchMessagesFilterPhotoAndVideo>() : nullptr, 0, 0),
-                   [this](Object object) {
-          if (object->get_id() == td_api::error::ID) {
-            auto&& e = td::move_tl_object_as<td_api::error>(object);
-            std::cout << "Error searching for messages: " << e->message_
-            << std::endl;
-            return;
-          }
 
-          auto results = td_api::move_object_as<td_api::foundChatMessages>(object);
-          std::cout << "Search results: [" << results->messages_.size() << "]"<< std::endl;
-          for (auto it = results->messages_.begin(); it < results->messages_.end(); ++it) {
-            print_msg(*it);
-          }
-        });
+      auto results = td_api::move_object_as<td_api::foundChatMessages>(object);
+      std::cout << "Search results: [" << results->messages_.size() << "]"<< std::endl;
+      for (auto it = results->messages_.begin(); it < results->messages_.end(); ++it) {
+        print_msg(*it);
       }
-    }
+    });
   }
+  return true;
+}
+
+void TdMain::print_status() {
+  auto print = [](const char* name, const NameCache& cache) {
+    std::cout << "  " << name << ": " << cache.size() << " entries, "
+      << cache.strings() << " distinct names, " << cache.memory() / 1024
+      << " KB, " << cache.evictions() << " evicted" << std::endl;
+  };
+  std::cout << "Cache status: " << std::endl;
+  print("users", users_);
+  print("chats", chat_title_);
+  std::cout << "  chat snapshot: " << chat_snapshot_->size() << " chats" << std::endl;
+  std::cout << "  search index: " << SearchIndex::instance().documents() << " messages, "
+    << SearchIndex::instance().terms() << " terms" << std::endl;
 }
 
 void TdMain::terminate() {
@@ -281,23 +451,54 @@ void TdMain::launch_task(Task* task) {
     }, task));
 }
 
+void TdMain::schedule_task(TdTask* task) {
+  task_handles_.push_back(task);
+  scheduled_.push_back(task);
+  executor_.submit(task);
+}
+
+std::int32_t TdMain::pick_account(std::int64_t chat_id) {
+  std::vector<std::int32_t> running(client_ptr_->accounts(), 0);
+  for (auto task : scheduled_) {
+    if (!task->done() && dynamic_cast<Downloader*>(task) != nullptr) {
+      ++running[task->account()];
+    }
+  }
+  std::int32_t best = -1;
+  for (auto account : client_ptr_->accounts_with_chat(chat_id)) {
+    if (client_ptr_->authorized(account) &&
+      (best < 0 || running[account] < running[best])) {
+      best = account;
+    }
+  }
+  if (best < 0) {
+    std::cout << "No account has seen chat [" << chat_id
+      << "] yet, using the primary account." << std::endl;
+    return 0;
+  }
+  return best;
+}
+
 void TdMain::process_update(Object& update) {
   td_api::downcast_call(
     *update,
     overloaded(
       [this](td_api::updateNewChat& update_new_chat) {
-        chat_title_[update_new_chat.chat_->id_] =
-          update_new_chat.chat_->title_;
+        chat_title_.put(update_new_chat.chat_->id_, update_new_chat.chat_->title_);
+        chat_snapshot_->put(update_new_chat.chat_->id_, update_new_chat.chat_->title_);
       },
       [this](td_api::updateChatTitle& update_chat_title) {
-        chat_title_[update_chat_title.chat_id_] = update_chat_title.title_;
+        chat_title_.put(update_chat_title.chat_id_, update_chat_title.title_);
+        chat_snapshot_->put(update_chat_title.chat_id_, update_chat_title.title_);
       },
         [this](td_api::updateUser& update_user) {
-        auto user_id = update_user.user_->id_;
-        users_[user_id] = std::move(update_user.user_);
+        auto& user = *update_user.user_;
+        users_.put(user.id_, user.first_name_, user.last_name_);
       },
         [this](td_api::updateNewMessage& update_new_message) {
           auto chat_id = update_new_message.message_->chat_id_;
+          SearchIndex::instance().add(chat_id, update_new_message.message_->id_,
+            searchable_text(*update_new_message.message_));
           std::string sender_name;
           td_api::downcast_call(
                                 *update_new_message.message_->sender_id_,
@@ -2,27 +2,164 @@
 
 using namespace task_api;
 
-TdTask::TdTask(ClientWrapper* client_ptr) : client_ptr_(client_ptr) {}
+TdTask::TdTask(ClientWrapper* client_ptr, std::int32_t account)
+  : client_ptr_(client_ptr), account_(account) {}
 
 void TdTask::accept_response(td::ClientManager::Response response) {
-  std::lock_guard<std::mutex> lock(queue_lock_);
-  responses_.push_back(std::move(response));
+  Metrics::instance().add(Metrics::kTaskQueued);
+  responses_.push(QueuedResponse{std::move(response),
+    Tracer::enabled() ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point()});
+  notify();
 }
 
-void TdTask::process_responses() {
-  std::lock_guard<std::mutex> lock(queue_lock_);
-  while (!responses_.empty()) {
-    td::ClientManager::Response& res = responses_.at(0);
-    if (res.request_id == 0) {
-      process_update(res.object);
+void TdTask::terminate() {
+  {
+    std::lock_guard<std::mutex> lock(wait_lock_);
+    Task::terminate();
+  }
+  notify();
+}
+
+void TdTask::notify() {
+  Executor* executor = executor_.load();
+  if (executor != nullptr) {
+    executor->wake(this);
+    return;
+  }
+  // pairs with the fence in wait_for_responses so a wakeup is never lost
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(wait_lock_);
+    responses_available_.notify_all();
+  }
+}
+
+void TdTask::run() {
+  while (true) {
+    StepResult result = step();
+    if (result == StepResult::kDone) {
+      return;
+    }
+    if (result == StepResult::kPark) {
+      wait_for_responses(wake_at_);
+    }
+  }
+}
+
+void TdTask::wait_for_responses(std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(wait_lock_);
+  waiting_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto ready = [this] { return woken_.exchange(false) || !responses_.empty() || terminate_; };
+  if (deadline == std::chrono::steady_clock::time_point::max()) {
+    responses_available_.wait(lock, ready);
+  }
+  else {
+    responses_available_.wait_until(lock, deadline, ready);
+  }
+  waiting_.store(false, std::memory_order_relaxed);
+}
+
+std::size_t TdTask::process_responses() {
+  std::size_t handled = 0;
+  while (responses_.drain(batch_) > 0) {
+    handled += batch_.size();
+    Metrics::instance().add(Metrics::kTaskHandled, static_cast<int64_t>(batch_.size()));
+    for (auto& item : batch_) {
+      auto& res = item.response;
+      bool traced = Tracer::enabled() && item.queued != std::chrono::steady_clock::time_point();
+      if (traced) {
+        Tracer::instance().record({.name = "queue wait", .category = "queue", .async = true,
+          .id = Tracer::instance().next_id(), .begin = item.queued,
+          .end = std::chrono::steady_clock::now()});
+      }
+      if (res.request_id == 0) {
+        TraceScope scope({.name = "update", .category = "handler",
+          .arg_name = "type", .arg = res.object->get_id()});
+        if (!complete_file_waiter(res.object)) {
+          process_update(res.object);
+        }
+      }
+      else {
+        auto pair = handlers_.find(res.request_id);
+        if (pair != handlers_.end()) {
+          // a handler may resume a coroutine that sends or drops queries
+          auto query = std::move(pair->second);
+          handlers_.erase(pair);
+          Metrics::instance().query_latency(query.type_id,
+            std::chrono::steady_clock::now() - query.sent);
+          if (traced) {
+            // until the response reached the task
+            Tracer::instance().record({.type_id = query.type_id, .category = "query", .async = true,
+              .id = res.request_id, .begin = query.sent, .end = item.queued});
+          }
+          TraceScope scope({.type_id = query.type_id, .category = "handler"});
+          query.handler(std::move(res.object));
+        }
+      }
     }
-    else {
-      auto pair = handlers_.find(res.request_id);
-      if (pair != handlers_.end()) {
-        pair->second(std::move(res.object));
-        handlers_.erase(pair);
+    batch_.clear();
+  }
+  resume_ready();
+  return handled;
+}
+
+bool TdTask::complete_file_waiter(Object& update) {
+  if (file_waiters_.empty() || update->get_id() != td_api::updateFile::ID) {
+    return false;
+  }
+  auto& file = static_cast<td_api::updateFile&>(*update).file_;
+  if (!file->local_->is_downloading_completed_ && file->local_->is_downloading_active_) {
+    return false;
+  }
+  auto it = file_waiters_.find(file->id_);
+  if (it == file_waiters_.end()) {
+    return false;
+  }
+  auto waiter = std::move(it->second);
+  file_waiters_.erase(it);
+  waiter(std::move(file));
+  return true;
+}
+
+void TdTask::resume_ready() {
+  auto now = std::chrono::steady_clock::now();
+  while (!timers_.empty() && timers_.begin()->first <= now) {
+    auto handle = timers_.begin()->second;
+    timers_.erase(timers_.begin());
+    resume(handle);
+  }
+
+  // resumed coroutines may register new conditions, check until stable
+  bool resumed = true;
+  while (resumed && !conditions_.empty()) {
+    resumed = false;
+    auto pending = std::move(conditions_);
+    conditions_.clear();
+    for (auto& c : pending) {
+      if (c.second && c.first()) {
+        auto handle = c.second;
+        c.second = nullptr;
+        resume(handle);
+        resumed = true;
+      }
+    }
+    for (auto& c : pending) {
+      if (c.second) {
+        conditions_.push_back(std::move(c));
       }
     }
-    responses_.pop_front();
   }
 }
+
+void TdTask::destroy_coroutines() {
+  for (auto address : suspended_) {
+    std::coroutine_handle<>::from_address(address).destroy();
+  }
+  suspended_.clear();
+  // their handlers point into the destroyed frames
+  handlers_.clear();
+  file_waiters_.clear();
+  timers_.clear();
+  conditions_.clear();
+}
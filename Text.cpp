@@ -0,0 +1,122 @@
+#include "inc/text.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+using namespace task_api;
+
+namespace {
+inline bool is_space(unsigned char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+#if defined(__AVX2__)
+const std::size_t blockSize = 32;
+
+// bit i set when byte i is a bracket, or whitespace with collapse_space
+inline unsigned special_bytes(const char* p, bool collapse_space) {
+  __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('[')),
+    _mm256_cmpeq_epi8(x, _mm256_set1_epi8(']')));
+  if (collapse_space) {
+    // '\t'..'\r' is x - '\t' <= 4 unsigned
+    __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+  }
+  return static_cast<unsigned>(_mm256_movemask_epi8(m));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+const std::size_t blockSize = 16;
+
+inline unsigned special_bytes(const char* p, bool collapse_space) {
+  __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('[')),
+    _mm_cmpeq_epi8(x, _mm_set1_epi8(']')));
+  if (collapse_space) {
+    __m128i t = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+  }
+  return static_cast<unsigned>(_mm_movemask_epi8(m));
+}
+#else
+const std::size_t blockSize = 8;
+
+inline unsigned special_bytes(const char* p, bool collapse_space) {
+  unsigned mask = 0;
+  for (std::size_t i = 0; i < blockSize; ++i) {
+    unsigned char c = p[i];
+    if (c == '[' || c == ']' || (collapse_space && is_space(c))) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+#endif
+
+inline unsigned lowest_bit(unsigned mask) {
+#if defined(__GNUC__)
+  return __builtin_ctz(mask);
+#else
+  unsigned i = 0;
+  while ((mask & 1) == 0) {
+    mask >>= 1;
+    ++i;
+  }
+  return i;
+#endif
+}
+}  // namespace
+
+void task_api::normalize_text(std::string& s, bool collapse_space) {
+  char* p = &s[0];
+  std::size_t n = s.size();
+  std::size_t r = 0;
+  std::size_t w = 0;
+  bool space = false;
+  while (r < n) {
+    // copy plain runs a block at a time, up to the next byte to change
+    while (r + blockSize <= n) {
+      unsigned mask = special_bytes(p + r, collapse_space);
+      std::size_t plain = mask == 0 ? blockSize : lowest_bit(mask);
+      if (plain > 0) {
+        if (w != r) {
+          std::memmove(p + w, p + r, plain);
+        }
+        r += plain;
+        w += plain;
+        space = false;
+      }
+      if (mask != 0) {
+        break;
+      }
+    }
+    if (r == n) {
+      break;
+    }
+
+    char c = p[r++];
+    if (collapse_space && is_space(c)) {
+      if (!space) {
+        p[w++] = ' ';
+        space = true;
+      }
+      continue;
+    }
+    space = false;
+    if (c == '[') {
+      c = '(';
+    }
+    else if (c == ']') {
+      c = ')';
+    }
+    p[w++] = c;
+  }
+  s.resize(w);
+}
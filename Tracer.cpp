@@ -0,0 +1,131 @@
+#include "inc/tracer.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "inc/metrics.h"
+
+using namespace task_api;
+
+namespace {
+// microseconds with ns precision, as trace viewers expect
+std::string micros(std::chrono::steady_clock::duration d) {
+  char buf[32];
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  std::snprintf(buf, sizeof(buf), "%" PRId64 ".%03" PRId64, ns / 1000, ns % 1000);
+  return buf;
+}
+}  // namespace
+
+Tracer& Tracer::instance() {
+  static Tracer tracer;
+  return tracer;
+}
+
+Tracer::RingOwner::~RingOwner() {
+  if (ring != nullptr) {
+    Tracer::instance().release(ring);
+  }
+}
+
+Tracer::Ring& Tracer::ring() {
+  thread_local RingOwner owner;
+  if (owner.ring == nullptr) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!free_rings_.empty()) {
+      owner.ring = free_rings_.back();
+      free_rings_.pop_back();
+    }
+    else {
+      auto ring = std::make_unique<Ring>();
+      ring->entries.resize(ringEvents);
+      owner.ring = ring.get();
+      rings_.push_back(std::move(ring));
+    }
+    std::lock_guard<std::mutex> ring_lock(owner.ring->lock);
+    owner.ring->tid = ++next_tid_;
+  }
+  return *owner.ring;
+}
+
+void Tracer::release(Ring* ring) {
+  std::lock_guard<std::mutex> lock(lock_);
+  free_rings_.push_back(ring);
+}
+
+void Tracer::start() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    for (auto& r : rings_) {
+      std::lock_guard<std::mutex> ring_lock(r->lock);
+      r->next = 0;
+      r->wrapped = false;
+    }
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::record(const TraceSpan& span) {
+  Ring& r = ring();
+  std::lock_guard<std::mutex> lock(r.lock);
+  r.entries[r.next] = Entry{span, r.tid};
+  if (++r.next == r.entries.size()) {
+    r.next = 0;
+    r.wrapped = true;
+  }
+}
+
+int64_t Tracer::stop(const std::string& path) {
+  enabled_.store(false, std::memory_order_relaxed);
+  std::ofstream out(path, std::ios_base::out | std::ios_base::trunc);
+  if (!out.is_open()) {
+    return -1;
+  }
+
+  int64_t written = 0;
+  bool first = true;
+  auto event = [&](const TraceSpan& span, int32_t tid, char phase,
+    std::chrono::steady_clock::time_point ts, bool with_args) {
+    out << (first ? "\n" : ",\n") << "{\"name\":\""
+      << (span.name != nullptr ? std::string(span.name) : Metrics::instance().query_name(span.type_id))
+      << "\",\"cat\":\"" << span.category << "\",\"ph\":\"" << phase
+      << "\",\"ts\":" << micros(ts - epoch_) << ",\"pid\":1,\"tid\":" << tid;
+    if (phase == 'X') {
+      out << ",\"dur\":" << micros(span.end - span.begin);
+    }
+    if (span.async) {
+      out << ",\"id\":" << span.id;
+    }
+    if (with_args && span.arg_name != nullptr) {
+      out << ",\"args\":{\"" << span.arg_name << "\":" << span.arg << "}";
+    }
+    out << "}";
+    first = false;
+  };
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto& r : rings_) {
+    std::lock_guard<std::mutex> ring_lock(r->lock);
+    // oldest first
+    std::size_t begin = r->wrapped ? r->next : 0;
+    std::size_t count = r->wrapped ? r->entries.size() : r->next;
+    for (std::size_t i = 0; i < count; ++i) {
+      const Entry& entry = r->entries[(begin + i) % r->entries.size()];
+      const TraceSpan& span = entry.span;
+      if (span.async) {
+        event(span, entry.tid, 'b', span.begin, true);
+        event(span, entry.tid, 'e', span.end, false);
+      }
+      else {
+        event(span, entry.tid, 'X', span.begin, true);
+      }
+      ++written;
+    }
+  }
+  out << "\n]}\n";
+  out.close();
+  return out.good() ? written : -1;
+}
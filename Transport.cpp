@@ -0,0 +1,779 @@
+#include "inc/transport.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+using namespace task_api;
+
+namespace td_api = td::td_api;
+
+namespace {
+// record kinds
+const std::uint8_t kRequest = 1;
+const std::uint8_t kResponse = 2;
+
+const char recordingMagic[] = {'T', 'D', 'R', '1'};
+// how long a recorded response waits for the matching live request
+constexpr auto matchTimeout = std::chrono::seconds(5);
+
+class Writer {
+ public:
+  std::string buf;
+
+  void u64(std::uint64_t v) {
+    while (v >= 0x80) {
+      buf.push_back(static_cast<char>(v | 0x80));
+      v >>= 7;
+    }
+    buf.push_back(static_cast<char>(v));
+  }
+  void i64(std::int64_t v) {
+    u64((static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63));
+  }
+  void flag(bool v) { buf.push_back(v ? 1 : 0); }
+  void str(const std::string& s) {
+    u64(s.size());
+    buf.append(s);
+  }
+};
+
+class Reader {
+ public:
+  Reader(const char* p, const char* end) : p_(p), end_(end) {}
+
+  bool ok() const { return ok_; }
+  const char* pos() const { return p_; }
+  std::uint64_t u64() {
+    std::uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p_ == end_) {
+        ok_ = false;
+        return 0;
+      }
+      auto byte = static_cast<std::uint8_t>(*p_++);
+      v |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if (byte < 0x80) {
+        return v;
+      }
+    }
+    ok_ = false;
+    return 0;
+  }
+  std::int64_t i64() {
+    std::uint64_t v = u64();
+    return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1);
+  }
+  std::int32_t i32() { return static_cast<std::int32_t>(i64()); }
+  bool flag() {
+    if (p_ == end_) {
+      ok_ = false;
+      return false;
+    }
+    return *p_++ != 0;
+  }
+  std::string str() {
+    std::uint64_t n = u64();
+    if (n > static_cast<std::uint64_t>(end_ - p_)) {
+      ok_ = false;
+      return std::string();
+    }
+    std::string s(p_, n);
+    p_ += n;
+    return s;
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+  bool ok_{true};
+};
+
+void encode(Writer& w, const td_api::Object* object);
+
+void encode_text(Writer& w, const td_api::object_ptr<td_api::formattedText>& text) {
+  w.str(text ? text->text_ : std::string());
+}
+
+void encode_file(Writer& w, const td_api::file& f) {
+  w.i64(f.id_);
+  w.i64(f.size_);
+  w.i64(f.expected_size_);
+  w.flag(static_cast<bool>(f.local_));
+  if (f.local_) {
+    w.str(f.local_->path_);
+    w.flag(f.local_->can_be_downloaded_);
+    w.flag(f.local_->is_downloading_active_);
+    w.flag(f.local_->is_downloading_completed_);
+    w.i64(f.local_->download_offset_);
+    w.i64(f.local_->downloaded_prefix_size_);
+    w.i64(f.local_->downloaded_size_);
+  }
+  w.flag(static_cast<bool>(f.remote_));
+  if (f.remote_) {
+    w.str(f.remote_->id_);
+    w.str(f.remote_->unique_id_);
+    w.flag(f.remote_->is_uploading_active_);
+    w.flag(f.remote_->is_uploading_completed_);
+    w.i64(f.remote_->uploaded_size_);
+  }
+}
+
+void encode_messages(Writer& w, const std::vector<td_api::object_ptr<td_api::message>>& messages) {
+  w.u64(messages.size());
+  for (auto& m : messages) {
+    encode(w, m.get());
+  }
+}
+
+// type id (0 for null) followed by the fields we keep; types without an
+// entry here are reduced to their id
+void encode(Writer& w, const td_api::Object* object) {
+  if (object == nullptr) {
+    w.i64(0);
+    return;
+  }
+  w.i64(object->get_id());
+  switch (object->get_id()) {
+    case td_api::error::ID: {
+      auto& o = static_cast<const td_api::error&>(*object);
+      w.i64(o.code_);
+      w.str(o.message_);
+      break;
+    }
+    case td_api::file::ID:
+      encode_file(w, static_cast<const td_api::file&>(*object));
+      break;
+    case td_api::messages::ID: {
+      auto& o = static_cast<const td_api::messages&>(*object);
+      w.i64(o.total_count_);
+      encode_messages(w, o.messages_);
+      break;
+    }
+    case td_api::foundChatMessages::ID: {
+      auto& o = static_cast<const td_api::foundChatMessages&>(*object);
+      w.i64(o.total_count_);
+      encode_messages(w, o.messages_);
+      w.i64(o.next_from_message_id_);
+      break;
+    }
+    case td_api::message::ID: {
+      auto& o = static_cast<const td_api::message&>(*object);
+      w.i64(o.id_);
+      encode(w, o.sender_id_.get());
+      w.i64(o.chat_id_);
+      w.i64(o.date_);
+      w.flag(static_cast<bool>(o.forward_info_));
+      encode(w, o.content_.get());
+      break;
+    }
+    case td_api::messageSenderUser::ID:
+      w.i64(static_cast<const td_api::messageSenderUser&>(*object).user_id_);
+      break;
+    case td_api::messageSenderChat::ID:
+      w.i64(static_cast<const td_api::messageSenderChat&>(*object).chat_id_);
+      break;
+    case td_api::messageText::ID:
+      encode_text(w, static_cast<const td_api::messageText&>(*object).text_);
+      break;
+    case td_api::messagePhoto::ID:
+      encode_text(w, static_cast<const td_api::messagePhoto&>(*object).caption_);
+      break;
+    case td_api::messageVideo::ID: {
+      auto& o = static_cast<const td_api::messageVideo&>(*object);
+      encode(w, o.video_.get());
+      encode_text(w, o.caption_);
+      break;
+    }
+    case td_api::video::ID: {
+      auto& o = static_cast<const td_api::video&>(*object);
+      w.i64(o.duration_);
+      w.str(o.file_name_);
+      w.str(o.mime_type_);
+      encode(w, o.video_.get());
+      break;
+    }
+    case td_api::messageDocument::ID: {
+      auto& o = static_cast<const td_api::messageDocument&>(*object);
+      encode(w, o.document_.get());
+      encode_text(w, o.caption_);
+      break;
+    }
+    case td_api::document::ID: {
+      auto& o = static_cast<const td_api::document&>(*object);
+      w.str(o.file_name_);
+      encode(w, o.document_.get());
+      break;
+    }
+    case td_api::chats::ID: {
+      auto& o = static_cast<const td_api::chats&>(*object);
+      w.i64(o.total_count_);
+      w.u64(o.chat_ids_.size());
+      for (auto id : o.chat_ids_) {
+        w.i64(id);
+      }
+      break;
+    }
+    case td_api::chat::ID: {
+      auto& o = static_cast<const td_api::chat&>(*object);
+      w.i64(o.id_);
+      w.str(o.title_);
+      break;
+    }
+    case td_api::user::ID: {
+      auto& o = static_cast<const td_api::user&>(*object);
+      w.i64(o.id_);
+      w.str(o.first_name_);
+      w.str(o.last_name_);
+      break;
+    }
+    case td_api::updateFile::ID:
+      encode(w, static_cast<const td_api::updateFile&>(*object).file_.get());
+      break;
+    case td_api::updateNewChat::ID:
+      encode(w, static_cast<const td_api::updateNewChat&>(*object).chat_.get());
+      break;
+    case td_api::updateChatTitle::ID: {
+      auto& o = static_cast<const td_api::updateChatTitle&>(*object);
+      w.i64(o.chat_id_);
+      w.str(o.title_);
+      break;
+    }
+    case td_api::updateUser::ID:
+      encode(w, static_cast<const td_api::updateUser&>(*object).user_.get());
+      break;
+    case td_api::updateNewMessage::ID:
+      encode(w, static_cast<const td_api::updateNewMessage&>(*object).message_.get());
+      break;
+    case td_api::updateAuthorizationState::ID:
+      encode(w, static_cast<const td_api::updateAuthorizationState&>(*object)
+                  .authorization_state_.get());
+      break;
+    case td_api::getChatHistory::ID: {
+      auto& o = static_cast<const td_api::getChatHistory&>(*object);
+      w.i64(o.chat_id_);
+      w.i64(o.from_message_id_);
+      w.i64(o.offset_);
+      w.i64(o.limit_);
+      w.flag(o.only_local_);
+      break;
+    }
+    case td_api::downloadFile::ID:
+      w.i64(static_cast<const td_api::downloadFile&>(*object).file_id_);
+      break;
+    default:
+      break;
+  }
+}
+
+td_api::object_ptr<td_api::Object> decode(Reader& r);
+
+template <class T>
+td_api::object_ptr<T> decode_as(Reader& r) {
+  auto object = decode(r);
+  if (!object || object->get_id() != T::ID) {
+    return nullptr;
+  }
+  return td::move_tl_object_as<T>(object);
+}
+
+td_api::object_ptr<td_api::formattedText> decode_text(Reader& r) {
+  auto text = td_api::make_object<td_api::formattedText>();
+  text->text_ = r.str();
+  return text;
+}
+
+td_api::object_ptr<td_api::file> decode_file(Reader& r) {
+  auto f = td_api::make_object<td_api::file>();
+  f->id_ = r.i32();
+  f->size_ = r.i64();
+  f->expected_size_ = r.i64();
+  if (r.flag()) {
+    f->local_ = td_api::make_object<td_api::localFile>();
+    f->local_->path_ = r.str();
+    f->local_->can_be_downloaded_ = r.flag();
+    f->local_->is_downloading_active_ = r.flag();
+    f->local_->is_downloading_completed_ = r.flag();
+    f->local_->download_offset_ = r.i64();
+    f->local_->downloaded_prefix_size_ = r.i64();
+    f->local_->downloaded_size_ = r.i64();
+  }
+  if (r.flag()) {
+    f->remote_ = td_api::make_object<td_api::remoteFile>();
+    f->remote_->id_ = r.str();
+    f->remote_->unique_id_ = r.str();
+    f->remote_->is_uploading_active_ = r.flag();
+    f->remote_->is_uploading_completed_ = r.flag();
+    f->remote_->uploaded_size_ = r.i64();
+  }
+  return f;
+}
+
+void decode_messages(Reader& r, std::vector<td_api::object_ptr<td_api::message>>& messages) {
+  std::uint64_t n = r.u64();
+  for (std::uint64_t i = 0; i < n && r.ok(); ++i) {
+    auto m = decode_as<td_api::message>(r);
+    if (m) {
+      messages.push_back(std::move(m));
+    }
+  }
+}
+
+// returns null for null objects and for types that were not stored
+td_api::object_ptr<td_api::Object> decode(Reader& r) {
+  std::int32_t id = r.i32();
+  switch (id) {
+    case td_api::error::ID: {
+      auto o = td_api::make_object<td_api::error>();
+      o->code_ = r.i32();
+      o->message_ = r.str();
+      return std::move(o);
+    }
+    case td_api::ok::ID:
+      return td_api::make_object<td_api::ok>();
+    case td_api::file::ID:
+      return decode_file(r);
+    case td_api::messages::ID: {
+      auto o = td_api::make_object<td_api::messages>();
+      o->total_count_ = r.i32();
+      decode_messages(r, o->messages_);
+      return std::move(o);
+    }
+    case td_api::foundChatMessages::ID: {
+      auto o = td_api::make_object<td_api::foundChatMessages>();
+      o->total_count_ = r.i32();
+      decode_messages(r, o->messages_);
+      o->next_from_message_id_ = r.i64();
+      return std::move(o);
+    }
+    case td_api::message::ID: {
+      auto o = td_api::make_object<td_api::message>();
+      o->id_ = r.i64();
+      auto sender = decode(r);
+      if (sender) {
+        o->sender_id_ = td::move_tl_object_as<td_api::MessageSender>(sender);
+      }
+      o->chat_id_ = r.i64();
+      o->date_ = r.i32();
+      if (r.flag()) {
+        o->forward_info_ = td_api::make_object<td_api::messageForwardInfo>();
+      }
+      auto content = decode(r);
+      if (content) {
+        o->content_ = td::move_tl_object_as<td_api::MessageContent>(content);
+      }
+      else {
+        o->content_ = td_api::make_object<td_api::messageUnsupported>();
+      }
+      if (!o->sender_id_) {
+        return nullptr;
+      }
+      return std::move(o);
+    }
+    case td_api::messageSenderUser::ID: {
+      auto o = td_api::make_object<td_api::messageSenderUser>();
+      o->user_id_ = r.i64();
+      return std::move(o);
+    }
+    case td_api::messageSenderChat::ID: {
+      auto o = td_api::make_object<td_api::messageSenderChat>();
+      o->chat_id_ = r.i64();
+      return std::move(o);
+    }
+    case td_api::messageText::ID: {
+      auto o = td_api::make_object<td_api::messageText>();
+      o->text_ = decode_text(r);
+      return std::move(o);
+    }
+    case td_api::messagePhoto::ID: {
+      auto o = td_api::make_object<td_api::messagePhoto>();
+      o->caption_ = decode_text(r);
+      return std::move(o);
+    }
+    case td_api::messageVideo::ID: {
+      auto o = td_api::make_object<td_api::messageVideo>();
+      o->video_ = decode_as<td_api::video>(r);
+      o->caption_ = decode_text(r);
+      if (!o->video_) {
+        return nullptr;
+      }
+      return std::move(o);
+    }
+    case td_api::video::ID: {
+      auto o = td_api::make_object<td_api::video>();
+      o->duration_ = r.i32();
+      o->file_name_ = r.str();
+      o->mime_type_ = r.str();
+      o->video_ = decode_as<td_api::file>(r);
+      if (!o->video_) {
+        return nullptr;
+      }
+      return std::move(o);
+    }
+    case td_api::messageDocument::ID: {
+      auto o = td_api::make_object<td_api::messageDocument>();
+      o->document_ = decode_as<td_api::document>(r);
+      o->caption_ = decode_text(r);
+      if (!o->document_) {
+        return nullptr;
+      }
+      return std::move(o);
+    }
+    case td_api::document::ID: {
+      auto o = td_api::make_object<td_api::document>();
+      o->file_name_ = r.str();
+      o->document_ = decode_as<td_api::file>(r);
+      return std::move(o);
+    }
+    case td_api::chats::ID: {
+      auto o = td_api::make_object<td_api::chats>();
+      o->total_count_ = r.i32();
+      std::uint64_t n = r.u64();
+      for (std::uint64_t i = 0; i < n && r.ok(); ++i) {
+        o->chat_ids_.push_back(r.i64());
+      }
+      return std::move(o);
+    }
+    case td_api::chat::ID: {
+      auto o = td_api::make_object<td_api::chat>();
+      o->id_ = r.i64();
+      o->title_ = r.str();
+      return std::move(o);
+    }
+    case td_api::user::ID: {
+      auto o = td_api::make_object<td_api::user>();
+      o->id_ = r.i64();
+      o->first_name_ = r.str();
+      o->last_name_ = r.str();
+      return std::move(o);
+    }
+    case td_api::updateFile::ID: {
+      auto o = td_api::make_object<td_api::updateFile>();
+      o->file_ = decode_as<td_api::file>(r);
+      if (!o->file_ || !o->file_->local_) {
+        return nullptr;
+      }
+      return std::move(o);
+    }
+    case td_api::updateNewChat::ID: {
+      auto o = td_api::make_object<td_api::updateNewChat>();
+      o->chat_ = decode_as<td_api::chat>(r);
+      if (!o->chat_) {
+        return nullptr;
+      }
+      return std::move(o);
+    }
+    case td_api::updateChatTitle::ID: {
+      auto o = td_api::make_object<td_api::updateChatTitle>();
+      o->chat_id_ = r.i64();
+      o->title_ = r.str();
+      return std::move(o);
+    }
+    case td_api::updateUser::ID: {
+      auto o = td_api::make_object<td_api::updateUser>();
+      o->user_ = decode_as<td_api::user>(r);
+      if (!o->user_) {
+        return nullptr;
+      }
+      return std::move(o);
+    }
+    case td_api::updateNewMessage::ID: {
+      auto o = td_api::make_object<td_api::updateNewMessage>();
+      o->message_ = decode_as<td_api::message>(r);
+      if (!o->message_) {
+        return nullptr;
+      }
+      return std::move(o);
+    }
+    case td_api::updateAuthorizationState::ID: {
+      // only the states that need no input are replayed
+      auto state = decode(r);
+      if (!state) {
+        return nullptr;
+      }
+      auto o = td_api::make_object<td_api::updateAuthorizationState>();
+      o->authorization_state_ = td::move_tl_object_as<td_api::AuthorizationState>(state);
+      return std::move(o);
+    }
+    case td_api::authorizationStateReady::ID:
+      return td_api::make_object<td_api::authorizationStateReady>();
+    case td_api::authorizationStateLoggingOut::ID:
+      return td_api::make_object<td_api::authorizationStateLoggingOut>();
+    case td_api::authorizationStateClosing::ID:
+      return td_api::make_object<td_api::authorizationStateClosing>();
+    case td_api::authorizationStateClosed::ID:
+      return td_api::make_object<td_api::authorizationStateClosed>();
+    default:
+      return nullptr;
+  }
+}
+
+std::int32_t payload_type(const std::string& payload) {
+  Reader r(payload.data(), payload.data() + payload.size());
+  return r.i32();
+}
+}  // namespace
+
+td_api::object_ptr<td_api::Object> task_api::copy_object(const td_api::Object& object) {
+  Writer w;
+  encode(w, &object);
+  Reader r(w.buf.data(), w.buf.data() + w.buf.size());
+  return decode(r);
+}
+
+RecordingTransport::RecordingTransport(std::unique_ptr<Transport> inner,
+  const std::string& path)
+  : inner_(std::move(inner)),
+  out_(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc),
+  start_(std::chrono::steady_clock::now()) {
+  if (!out_.is_open()) {
+    std::cout << "Failed to open recording file [" << path << "]" << std::endl;
+    return;
+  }
+  out_.write(recordingMagic, sizeof(recordingMagic));
+}
+
+RecordingTransport::~RecordingTransport() {
+  if (out_.is_open()) {
+    out_.close();
+  }
+}
+
+std::int32_t RecordingTransport::create_client_id() {
+  return inner_->create_client_id();
+}
+
+void RecordingTransport::send(std::int32_t client_id, std::uint64_t request_id,
+  td_api::object_ptr<td_api::Function> f) {
+  write(kRequest, client_id, request_id, f.get());
+  inner_->send(client_id, request_id, std::move(f));
+}
+
+td::ClientManager::Response RecordingTransport::receive(double timeout) {
+  auto response = inner_->receive(timeout);
+  if (response.object) {
+    write(kResponse, response.client_id, response.request_id, response.object.get());
+  }
+  else {
+    // idle, a good moment to make the recording durable
+    std::lock_guard<std::mutex> lock(out_lock_);
+    out_.flush();
+  }
+  return response;
+}
+
+// record: varint length, kind, time offset (us), client id, request id, object
+void RecordingTransport::write(std::uint8_t kind, std::int32_t client_id,
+  std::uint64_t request_id, const td_api::Object* object) {
+  Writer w;
+  w.buf.push_back(static_cast<char>(kind));
+  w.i64(std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start_).count());
+  w.i64(client_id);
+  w.u64(request_id);
+  encode(w, object);
+
+  Writer len;
+  len.u64(w.buf.size());
+  std::lock_guard<std::mutex> lock(out_lock_);
+  out_.write(len.buf.data(), len.buf.size());
+  out_.write(w.buf.data(), w.buf.size());
+}
+
+ReplayTransport::ReplayTransport(const std::string& path, double speed)
+  : speed_(speed) {
+  std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (data.size() < sizeof(recordingMagic) ||
+    data.compare(0, sizeof(recordingMagic), recordingMagic, sizeof(recordingMagic)) != 0) {
+    std::cout << "Not a recording: [" << path << "]" << std::endl;
+    return;
+  }
+
+  const char* end = data.data() + data.size();
+  Reader r(data.data() + sizeof(recordingMagic), end);
+  std::map<std::uint64_t, std::size_t> requests;
+  while (r.pos() < end) {
+    std::uint64_t n = r.u64();
+    const char* body = r.pos();
+    if (!r.ok() || n == 0 || n > static_cast<std::uint64_t>(end - body)) {
+      std::cout << "Recording truncated after " << records_.size() << " records" << std::endl;
+      break;
+    }
+    Reader fields(body + 1, body + n);
+    Record record;
+    record.kind = static_cast<std::uint8_t>(*body);
+    record.time = fields.i64();
+    record.client_id = fields.i32();
+    record.request_id = fields.u64();
+    record.payload.assign(fields.pos(), body + n);
+    if (record.kind == kRequest) {
+      requests[record.request_id] = records_.size();
+      by_payload_[record.payload].push_back(records_.size());
+      by_type_[payload_type(record.payload)].push_back(records_.size());
+    }
+    else if (record.request_id != 0) {
+      auto it = requests.find(record.request_id);
+      if (it != requests.end()) {
+        records_[it->second].answered = true;
+      }
+    }
+    records_.push_back(std::move(record));
+    r = Reader(body + n, end);
+  }
+  start_ = std::chrono::steady_clock::now();
+}
+
+std::int32_t ReplayTransport::create_client_id() {
+  // the n-th call gets the n-th client id of the recording, in order of
+  // first appearance
+  std::vector<std::int32_t> seen;
+  for (auto& record : records_) {
+    if (record.client_id != 0 &&
+      std::find(seen.begin(), seen.end(), record.client_id) == seen.end()) {
+      seen.push_back(record.client_id);
+    }
+  }
+  std::size_t n = clients_created_++;
+  if (n < seen.size()) {
+    return seen[n];
+  }
+  std::int32_t last = seen.empty() ? 0 : *std::max_element(seen.begin(), seen.end());
+  return last + static_cast<std::int32_t>(n - seen.size()) + 1;
+}
+
+std::size_t ReplayTransport::take(std::deque<std::size_t>& queue) {
+  while (!queue.empty()) {
+    std::size_t index = queue.front();
+    queue.pop_front();
+    if (!records_[index].matched) {
+      return index;
+    }
+  }
+  return records_.size();
+}
+
+void ReplayTransport::send(std::int32_t client_id, std::uint64_t request_id,
+  td_api::object_ptr<td_api::Function> f) {
+  Writer w;
+  encode(w, f.get());
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    // prefer the recorded request with the same parameters, e.g. the same
+    // file id, then the next recorded request of the same type
+    std::size_t index = take(by_payload_[w.buf]);
+    if (index == records_.size()) {
+      index = take(by_type_[f->get_id()]);
+    }
+    if (index != records_.size()) {
+      records_[index].matched = true;
+      while (first_unmatched_ < records_.size() &&
+        (records_[first_unmatched_].kind != kRequest || records_[first_unmatched_].matched)) {
+        ++first_unmatched_;
+      }
+    }
+
+    if (index != records_.size() && records_[index].answered) {
+      live_ids_[records_[index].request_id] = request_id;
+    }
+    else {
+      td::ClientManager::Response response;
+      response.client_id = client_id;
+      response.request_id = request_id;
+      response.object = td_api::make_object<td_api::error>(404, "Not in the recording");
+      immediate_.push_back(std::move(response));
+    }
+  }
+  sent_.notify_all();
+}
+
+td::ClientManager::Response ReplayTransport::receive(double timeout) {
+  auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(timeout));
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    if (!immediate_.empty()) {
+      auto response = std::move(immediate_.front());
+      immediate_.pop_front();
+      return response;
+    }
+
+    while (next_ < records_.size() && records_[next_].kind == kRequest) {
+      ++next_;
+    }
+    if (next_ == records_.size()) {
+      sent_.wait_until(lock, deadline);
+      if (immediate_.empty()) {
+        return td::ClientManager::Response();
+      }
+      continue;
+    }
+
+    // never run ahead of the application: everything recorded before this
+    // record was a reaction to requests that must have been sent by now
+    if (first_unmatched_ < next_) {
+      auto now = std::chrono::steady_clock::now();
+      if (gate_index_ != next_) {
+        gate_index_ = next_;
+        gate_since_ = now;
+      }
+      bool caught_up = sent_.wait_until(lock, std::min(deadline, gate_since_ + matchTimeout),
+        [this] { return first_unmatched_ >= next_ || !immediate_.empty(); });
+      if (speed_ > 0) {
+        start_ += std::chrono::steady_clock::now() - now;
+      }
+      if (caught_up) {
+        continue;
+      }
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return td::ClientManager::Response();
+      }
+      // the application went another way, stop waiting for those requests
+      for (std::size_t i = first_unmatched_; i < next_; ++i) {
+        records_[i].matched = true;
+      }
+      first_unmatched_ = next_;
+      continue;
+    }
+
+    Record& record = records_[next_];
+    if (speed_ > 0) {
+      auto due = start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::microseconds(record.time) / speed_);
+      if (due > std::chrono::steady_clock::now()) {
+        sent_.wait_until(lock, std::min(due, deadline));
+        if (std::chrono::steady_clock::now() >= deadline && immediate_.empty()) {
+          return td::ClientManager::Response();
+        }
+        continue;
+      }
+    }
+
+    ++next_;
+    std::uint64_t live_id = 0;
+    if (record.request_id != 0) {
+      auto it = live_ids_.find(record.request_id);
+      if (it == live_ids_.end()) {
+        // its request was never sent
+        continue;
+      }
+      live_id = it->second;
+      live_ids_.erase(it);
+    }
+
+    Reader r(record.payload.data(), record.payload.data() + record.payload.size());
+    auto object = decode(r);
+    if (!object || !r.ok()) {
+      if (live_id == 0) {
+        continue;
+      }
+      object = td_api::make_object<td_api::error>(500, "Response was not recorded");
+    }
+    td::ClientManager::Response response;
+    response.client_id = record.client_id;
+    response.request_id = live_id;
+    response.object = std::move(object);
+    return response;
+  }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+namespace bench {
+
+// Runs body once and prints its time per operation.
+template <class Body>
+double run(const char* name, std::size_t ops, Body&& body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  double ns = elapsed.count() * 1e9 / static_cast<double>(ops);
+  std::printf("%-48s %12.1f ns/op %10.2f Mops/s\n", name, ns, ops / elapsed.count() / 1e6);
+  return ns;
+}
+
+inline volatile std::size_t sink{0};
+
+// keeps the optimizer from dropping a result
+inline void keep(std::size_t value) {
+  sink = value;
+}
+}  // namespace bench
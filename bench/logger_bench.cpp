@@ -0,0 +1,86 @@
+// Logging overhead on the task threads: a typical download line through Log
+// against the std::ofstream with a strftime timestamp and std::endl per line
+// it replaced, from 1 to 8 threads, each with its own file. Logger's time
+// includes the final flush(); debug lines filtered out by the level are
+// timed too.
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "inc/logger.h"
+
+using namespace task_api;
+
+namespace {
+const int linesPerThread = 50000;
+
+std::string get_current_timestamp() {
+  char res[20];
+  time_t t = time(nullptr);
+  std::strftime(res, sizeof(res), "%FT%T", localtime(&t));
+  return std::string(res);
+}
+
+std::string path(int thread) {
+  return "./logger_bench_" + std::to_string(thread) + ".log";
+}
+
+void remove_files(int threads) {
+  for (int t = 0; t < threads; ++t) {
+    std::remove(path(t).c_str());
+    for (int i = 1; i <= 3; ++i) {
+      std::remove((path(t) + "." + std::to_string(i)).c_str());
+    }
+  }
+}
+
+template <class Body>
+void run(const std::string& name, int threads, Body body) {
+  remove_files(threads);
+  std::string label = name + ", " + std::to_string(threads) + " threads";
+  bench::run(label.c_str(), std::size_t(linesPerThread) * threads, [&] {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back(body, t);
+    }
+    for (auto& w : workers) {
+      w.join();
+    }
+    Logger::instance().flush();
+  });
+  remove_files(threads);
+}
+}  // namespace
+
+int main() {
+  for (int threads : {1, 4, 8}) {
+    run("ofstream + std::endl", threads, [](int t) {
+      std::ofstream log(path(t), std::ios_base::out | std::ios_base::app);
+      for (int32_t i = 0; i < linesPerThread; ++i) {
+        log << get_current_timestamp() << " INFO: File [/downloads/videos/" << i
+          << ".mp4], id[" << i << "] download completed." << std::endl;
+      }
+    });
+    run("Logger", threads, [](int t) {
+      Log log;
+      log.open(path(t));
+      for (int32_t i = 0; i < linesPerThread; ++i) {
+        log(LogLevel::kInfo) << "File [/downloads/videos/" << i << ".mp4], id[" << i
+          << "] download completed.";
+      }
+    });
+    run("Logger, filtered debug line", threads, [](int t) {
+      Log log;
+      log.open(path(t));
+      for (int32_t i = 0; i < linesPerThread; ++i) {
+        log(LogLevel::kDebug) << "Progress of file id[" << i << "]";
+      }
+    });
+  }
+  return 0;
+}
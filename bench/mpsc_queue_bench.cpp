@@ -0,0 +1,116 @@
+// accept_response throughput: producer threads push responses to one task
+// thread, which runs a handler for each. MpscQueue with handlers outside any
+// lock against the mutex-guarded deque whose lock was held by the handlers.
+// "push" is the time a producer (the receive thread) spends per response.
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "inc/mpsc_queue.h"
+
+using namespace task_api;
+
+namespace {
+// as td::ClientManager::Response
+struct Response {
+  uint64_t request_id{0};
+  std::unique_ptr<uint64_t> object;
+};
+
+const std::size_t perProducer = 200000;
+// TdTask::queueCapacity
+const std::size_t queueCapacity = 4096;
+
+// a short handler, as the bookkeeping of a response
+std::size_t handle(Response& response) {
+  std::size_t h = response.request_id + *response.object;
+  for (int i = 0; i < 64; ++i) {
+    h = h * 31 + i;
+  }
+  return h;
+}
+
+class LockedQueue {
+ public:
+  void push(Response&& response) {
+    std::lock_guard<std::mutex> lock(lock_);
+    responses_.push_back(std::move(response));
+  }
+  std::size_t process() {
+    std::lock_guard<std::mutex> lock(lock_);
+    std::size_t n = 0;
+    while (!responses_.empty()) {
+      bench::keep(handle(responses_.front()));
+      responses_.pop_front();
+      ++n;
+    }
+    return n;
+  }
+
+ private:
+  std::mutex lock_;
+  std::deque<Response> responses_;
+};
+
+class LockFreeQueue {
+ public:
+  void push(Response&& response) { responses_.push(std::move(response)); }
+  std::size_t process() {
+    batch_.clear();
+    std::size_t n = responses_.drain(batch_);
+    for (auto& response : batch_) {
+      bench::keep(handle(response));
+    }
+    return n;
+  }
+
+ private:
+  MpscQueue<Response> responses_{queueCapacity};
+  std::vector<Response> batch_;
+};
+
+template <class Queue>
+void run(const std::string& name, int producers) {
+  Queue queue;
+  std::size_t total = perProducer * producers;
+  std::atomic<int64_t> push_ns{0};
+  bench::run((name + ", " + std::to_string(producers) + " producers").c_str(), total, [&] {
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+      threads.emplace_back([&queue, &push_ns, p] {
+        std::chrono::steady_clock::duration pushing{};
+        for (std::size_t i = 0; i < perProducer; ++i) {
+          Response response{i + 1, std::make_unique<uint64_t>(p)};
+          auto start = std::chrono::steady_clock::now();
+          queue.push(std::move(response));
+          pushing += std::chrono::steady_clock::now() - start;
+        }
+        push_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(pushing).count();
+      });
+    }
+    for (std::size_t handled = 0; handled < total;) {
+      handled += queue.process();
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  });
+  std::printf("%-48s %12.1f ns/op\n", "  push", static_cast<double>(push_ns) / total);
+}
+}  // namespace
+
+int main() {
+  for (int producers : {1, 2, 4, 8}) {
+    run<LockedQueue>("mutex + deque", producers);
+    run<LockFreeQueue>("MpscQueue", producers);
+  }
+  return 0;
+}
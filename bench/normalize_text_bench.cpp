@@ -0,0 +1,100 @@
+// Caption normalization: normalize_text against the regex_replace and
+// replace_char calls it replaced, on the captions of a file (one per line,
+// e.g. exported from a chat) or on generated ones. Both must agree.
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "inc/text.h"
+
+using namespace task_api;
+
+namespace {
+void replace_char(std::string& s, char c1, char c2) {
+  size_t pos = s.find(c1, 0);
+  while (pos != std::string::npos) {
+    s.replace(pos, 1, 1, c2);
+    pos = s.find(c1, pos + 1);
+  }
+}
+
+std::string regex_version(const std::string& text) {
+  std::string caption = std::regex_replace(text, std::regex("\\s+"), " ");
+  replace_char(caption, '[', '(');
+  replace_char(caption, ']', ')');
+  return caption;
+}
+
+std::string normalize_version(const std::string& text) {
+  std::string caption = text;
+  normalize_text(caption, true);
+  return caption;
+}
+
+std::vector<std::string> generated(std::size_t count) {
+  const char* pieces[] = {"Episode", "第二集", "[1080p]", "Привет", "café", "  ", "\t",
+    "\r\n", "part", "(HD)", "#tag", "日本語の字幕", "[end]", "x264", "2024", "   \n  "};
+  std::mt19937 random(42);
+  std::vector<std::string> captions;
+  for (std::size_t i = 0; i < count; ++i) {
+    std::string caption;
+    auto words = 2 + random() % 40;
+    for (std::size_t w = 0; w < words; ++w) {
+      caption += pieces[random() % std::size(pieces)];
+      caption += ' ';
+    }
+    captions.push_back(std::move(caption));
+  }
+  return captions;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> captions;
+  if (argc > 1) {
+    std::ifstream f(argv[1]);
+    for (std::string line; std::getline(f, line);) {
+      captions.push_back(line);
+    }
+    if (captions.empty()) {
+      std::printf("No captions in [%s]\n", argv[1]);
+      return 1;
+    }
+  }
+  else {
+    captions = generated(20000);
+  }
+  std::size_t bytes = 0;
+  for (auto& c : captions) {
+    bytes += c.size();
+  }
+  std::printf("%zu captions, %zu bytes on average\n", captions.size(), bytes / captions.size());
+
+  std::size_t mismatches = 0;
+  for (auto& c : captions) {
+    if (regex_version(c) != normalize_version(c)) {
+      ++mismatches;
+    }
+  }
+  if (mismatches > 0) {
+    std::printf("%zu captions are normalized differently\n", mismatches);
+    return 1;
+  }
+
+  bench::run("regex_replace + replace_char", captions.size(), [&] {
+    for (auto& c : captions) {
+      bench::keep(regex_version(c).size());
+    }
+  });
+  bench::run("normalize_text", captions.size(), [&] {
+    for (auto& c : captions) {
+      bench::keep(normalize_version(c).size());
+    }
+  });
+  return 0;
+}
@@ -0,0 +1,105 @@
+// send_query/response bookkeeping: sender threads publish monotonic query
+// ids while the receive thread retires them in order, with a fixed number
+// of queries in flight. QueryRegistry against the mutex-guarded std::map it
+// replaced; 100k in flight is past ClientWrapper's 64k slots, so part of
+// the ids go through the overflow map.
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "inc/query_registry.h"
+
+using namespace task_api;
+
+namespace {
+struct Owner {};
+
+const uint64_t queries = 2000000;
+// ClientWrapper::registryCapacity
+const std::size_t registryCapacity = 1 << 16;
+
+class LockedRegistry {
+ public:
+  void publish(uint64_t query_id, Owner* owner) {
+    std::lock_guard<std::mutex> lock(lock_);
+    owners_[query_id] = owner;
+  }
+  Owner* retire(uint64_t query_id) {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = owners_.find(query_id);
+    if (it == owners_.end()) {
+      return nullptr;
+    }
+    Owner* owner = it->second;
+    owners_.erase(it);
+    return owner;
+  }
+
+ private:
+  std::mutex lock_;
+  std::map<uint64_t, Owner*> owners_;
+};
+
+class SlotRegistry {
+ public:
+  void publish(uint64_t query_id, Owner* owner) { registry_.publish(query_id, owner); }
+  Owner* retire(uint64_t query_id) { return registry_.retire(query_id); }
+
+ private:
+  QueryRegistry<Owner> registry_{registryCapacity};
+};
+
+template <class Registry>
+void run(const std::string& name, int senders, uint64_t in_flight) {
+  Registry registry;
+  Owner owner;
+  std::atomic<uint64_t> retired{0};
+  std::string label = name + ", " + std::to_string(senders) + " senders, "
+    + std::to_string(in_flight / 1000) + "k in flight";
+  bench::run(label.c_str(), queries, [&] {
+    // the first in_flight queries have no responses yet
+    for (uint64_t id = 1; id <= in_flight; ++id) {
+      registry.publish(id, &owner);
+    }
+    std::vector<std::thread> threads;
+    for (int s = 0; s < senders; ++s) {
+      threads.emplace_back([&, s] {
+        for (uint64_t id = in_flight + 1 + s; id <= queries + in_flight; id += senders) {
+          while (id > retired.load(std::memory_order_acquire) + in_flight) {
+            std::this_thread::yield();
+          }
+          registry.publish(id, &owner);
+        }
+      });
+    }
+    for (uint64_t id = 1; id <= queries; ++id) {
+      // the response of a query can't arrive before it was sent
+      while (registry.retire(id) == nullptr) {
+        std::this_thread::yield();
+      }
+      // published in batches, so the senders' polling doesn't dominate
+      if (id % 256 == 0 || id == queries) {
+        retired.store(id, std::memory_order_release);
+      }
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  });
+}
+}  // namespace
+
+int main() {
+  for (uint64_t in_flight : {16000, 100000}) {
+    for (int senders : {1, 4, 8}) {
+      run<LockedRegistry>("map + mutex", senders, in_flight);
+      run<SlotRegistry>("QueryRegistry", senders, in_flight);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+// Request to handler latency through ClientWrapper's receive loop and a
+// task's queue, with 1 to 256 queries in flight. The transport is a
+// ReplayTransport, which answers every query it has no record of at once,
+// so only TaskApi's own overhead is measured; pass a recording to replay it
+// instead of an empty one.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "inc/task_api.h"
+
+using namespace task_api;
+
+namespace {
+const std::size_t queries = 100000;
+const char emptyRecording[] = "./receive_loop_bench.rec";
+
+// sends getOption queries, keeping in_flight of them unanswered
+class PingTask : public TdTask {
+ public:
+  PingTask(ClientWrapper* client_ptr, std::size_t in_flight)
+    : TdTask(client_ptr), in_flight_(in_flight) {}
+
+  StepResult step() {
+    process_responses();
+    while (sent_ < queries && sent_ - latencies_.size() < in_flight_) {
+      auto sent = std::chrono::steady_clock::now();
+      send_query(td_api::make_object<td_api::getOption>("version"), [this, sent](Object) {
+        latencies_.push_back(std::chrono::steady_clock::now() - sent);
+      });
+      ++sent_;
+    }
+    return latencies_.size() == queries ? StepResult::kDone : StepResult::kPark;
+  }
+  void print_status() {}
+
+  std::vector<std::chrono::steady_clock::duration>& latencies() { return latencies_; }
+
+ protected:
+  void process_update(Object&) {}
+
+ private:
+  std::size_t in_flight_;
+  std::size_t sent_{0};
+  std::vector<std::chrono::steady_clock::duration> latencies_;
+};
+
+double micros(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string recording = emptyRecording;
+  if (argc > 1) {
+    recording = argv[1];
+  }
+  else {
+    std::ofstream(emptyRecording, std::ios_base::out | std::ios_base::binary) << "TDR1";
+  }
+  ClientWrapper client(std::make_unique<ReplayTransport>(recording, 0), {"."});
+  std::thread receiver([&client] { client.run(); });
+
+  for (std::size_t in_flight : {1, 16, 256}) {
+    PingTask task(&client, in_flight);
+    std::string label = std::to_string(in_flight) + " in flight";
+    bench::run(label.c_str(), queries, [&task] { task.run(); });
+    auto& latencies = task.latencies();
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&latencies](double q) { return micros(latencies[std::size_t(q * (latencies.size() - 1))]); };
+    std::printf("  latency us: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+      at(0.5), at(0.9), at(0.99), micros(latencies.back()));
+  }
+
+  client.terminate();
+  receiver.join();
+  if (argc <= 1) {
+    std::remove(emptyRecording);
+  }
+  return 0;
+}
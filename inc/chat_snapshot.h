@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace task_api {
+
+// Chat titles kept across runs, so TdMain knows them before TDLib has sent
+// updateNewChat for every chat. Stored in <database directory>/chats.snap
+// as an 8 byte magic followed by records of
+//
+//   int64 chat id, uint32 title length, title bytes
+//
+// in host byte order, appended as titles change; the last record of a chat
+// wins. The file is read through mmap, a torn last record is cut off, and
+// it is rewritten (to a temporary file renamed over it) on open when it
+// holds far more records than chats.
+class ChatSnapshot {
+ public:
+  ChatSnapshot(const ChatSnapshot& other) = delete;
+  ChatSnapshot& operator=(const ChatSnapshot& other) = delete;
+  explicit ChatSnapshot(const std::string& path);
+  ~ChatSnapshot();
+
+  // every record in file order, so a later title of a chat overrides an
+  // earlier one
+  void for_each(const std::function<void(int64_t, const std::string&)>& f) const;
+  // appends a record unless the title is unchanged
+  void put(int64_t chat_id, const std::string& title);
+  std::size_t size() const;
+
+ private:
+  std::string path_;
+  mutable std::mutex lock_;
+  int fd_{-1};
+  // chat id -> hash of its title, to skip unchanged titles
+  std::unordered_map<int64_t, uint64_t> titles_;
+  std::size_t records_{0};
+  const static std::size_t compactSlack = 4096;
+
+  void load();
+  // rewrites the file with the latest record of every chat, offsets point
+  // into data
+  void compact(const char* data, const std::unordered_map<int64_t, std::size_t>& latest);
+};
+}  // namespace task_api
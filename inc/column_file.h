@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace task_api {
+
+// One exported message.
+struct ExportRow {
+  int64_t msg_id{0};
+  int32_t date{0};
+  int64_t sender{0};        // user id, or chat id for chat senders
+  int32_t content_type{0};  // td_api constructor id of the content
+  int32_t file_id{0};       // 0 without a file
+  int64_t file_size{0};
+  std::string caption;
+};
+
+// Append-only columnar file of ExportRows, written in row groups so memory
+// stays bounded whatever the number of rows. Layout, host byte order:
+//
+//   "TDEXPRT1"
+//   row group: uint32 rows, uint32 reserved,
+//              then one chunk per column: uint64 length, bytes
+//
+// Columns, in order: msg_id int64[], date int32[], sender int64[],
+// content_type int32[], file_id int32[], file_size int64[], caption
+// offsets uint32[rows + 1] followed by the caption bytes. Every chunk is
+// padded to 8 bytes, so a reader can mmap the file and use the arrays in
+// place. A torn last row group is to be ignored by readers.
+class ColumnFileWriter {
+ public:
+  ColumnFileWriter(const ColumnFileWriter& other) = delete;
+  ColumnFileWriter& operator=(const ColumnFileWriter& other) = delete;
+  ColumnFileWriter() {}
+  ~ColumnFileWriter() { close(); }
+
+  bool open(const std::string& path);
+  bool is_open() const { return out_.is_open(); }
+  void add(const ExportRow& row);
+  // writes the buffered rows as a row group
+  void flush();
+  void close();
+  std::size_t rows() const { return rows_; }
+  std::size_t bytes() const { return bytes_; }
+
+ private:
+  std::ofstream out_;
+  std::vector<int64_t> msg_id_;
+  std::vector<int32_t> date_;
+  std::vector<int64_t> sender_;
+  std::vector<int32_t> content_type_;
+  std::vector<int32_t> file_id_;
+  std::vector<int64_t> file_size_;
+  std::vector<uint32_t> caption_offsets_;
+  std::string captions_;
+  std::size_t rows_{0};
+  std::size_t bytes_{0};
+  const static std::size_t groupRows = 4096;
+
+  // writes data and tail as one chunk
+  void chunk(const void* data, std::size_t length,
+             const void* tail = nullptr, std::size_t tail_length = 0);
+};
+}  // namespace task_api
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace task_api {
+
+// Bounds for the number of concurrent downloads, read from concurrency.ini:
+//
+//   min 1
+//   max 6
+//   # from hour, to hour (local time, exclusive), min, max
+//   window 0 6 2 10
+//   # history pages a Downloader scans ahead of its downloads
+//   lookahead 4
+//
+// The first window containing the current hour overrides min/max.
+struct ConcurrencyConfig {
+  struct Window {
+    int32_t from_hour;
+    int32_t to_hour;
+    int32_t min;
+    int32_t max;
+  };
+
+  int32_t min{1};
+  int32_t max{5};
+  int32_t lookahead{4};
+  std::vector<Window> windows;
+
+  void load(const std::string& path);
+  // bounds for the current local time
+  void bounds(int32_t& lo, int32_t& hi) const;
+};
+
+// AIMD controller for the in-flight download limit, fed with the bytes
+// downloaded, completion latencies and errors. Every interval in which the
+// limit was saturated it probes one more slot; a probe that did not raise
+// throughput is taken back, and errors or completion latency blowing up
+// without a throughput gain (the server throttling us) halve the limit.
+class ConcurrencyController {
+ public:
+  explicit ConcurrencyController(const ConcurrencyConfig& config);
+
+  int32_t limit() const { return limit_; }
+  // bytes/s measured over the last interval
+  double throughput() const { return throughput_; }
+
+  void on_progress(int64_t bytes) { bytes_ += bytes; }
+  void on_complete(std::chrono::steady_clock::duration latency, int64_t size);
+  void on_error() { ++errors_; }
+  // called whenever the number of running downloads may have changed
+  void update(int32_t in_flight);
+
+ private:
+  const ConcurrencyConfig& config_;
+  int32_t limit_;
+  std::chrono::steady_clock::time_point interval_start_;
+  std::chrono::steady_clock::time_point last_update_;
+  int32_t in_flight_{0};
+  double busy_time_{0};  // slot-seconds used during the interval
+  int64_t bytes_{0};
+  int32_t errors_{0};
+  double latency_sum_{0};  // seconds per MB of the completed downloads
+  int32_t completions_{0};
+  double throughput_{0};
+  double best_throughput_{0};  // at the current limit
+  // EWMA of seconds per MB per running download, lowest value seen
+  double latency_avg_{0};
+  double latency_base_{0};
+  bool probing_{false};        // limit was raised at the end of the last interval
+  int32_t hold_{0};            // intervals to wait before probing again
+
+  constexpr static std::chrono::seconds interval{10};
+  constexpr static double gain = 1.05;
+  constexpr static int32_t holdIntervals = 6;
+
+  void end_interval(double seconds);
+  void clamp();
+};
+}  // namespace task_api
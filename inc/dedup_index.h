@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace task_api {
+
+// Process-wide set of downloaded files keyed on the remote unique id and
+// size, so a video reposted in several chats is downloaded once. Kept in
+// dedup.idx of the primary account's database directory: an open-addressing
+// table of 64-bit key hashes mapped into memory, doubled (into a new file
+// renamed over the old one) when 70% full. Only the hash is stored; two
+// files colliding on it are a negligible risk at 64 bits.
+class DedupIndex {
+ public:
+  DedupIndex(const DedupIndex& other) = delete;
+  DedupIndex& operator=(const DedupIndex& other) = delete;
+  // the process-wide index is instance(), tests open their own
+  explicit DedupIndex(const std::string& path);
+  ~DedupIndex();
+
+  static DedupIndex& instance();
+  // the directory of the index file, set before the first instance()
+  static void set_directory(const std::string& directory);
+  // 0 when the file has no remote id
+  static uint64_t key(const std::string& unique_id, int64_t size);
+
+  bool contains(uint64_t key);
+  // false when the file is downloaded or being downloaded already
+  bool claim(uint64_t key);
+  // the claimed file was downloaded
+  void commit(uint64_t key);
+  void release(uint64_t key);
+  std::size_t size();
+
+ private:
+  struct Header {
+    char magic[8];
+    uint64_t capacity;
+    uint64_t count;
+  };
+
+  static std::string& directory();
+
+  std::string path_;
+  std::mutex lock_;
+  int fd_{-1};
+  Header* header_{nullptr};
+  uint64_t* slots_{nullptr};
+  std::size_t mapped_{0};
+  std::unordered_set<uint64_t> claimed_;
+  const static uint64_t initialCapacity = 1 << 16;
+
+  bool map(const std::string& path, uint64_t capacity, bool create);
+  void unmap();
+  bool find(uint64_t key) const;
+  void insert(uint64_t key);
+  void grow();
+};
+}  // namespace task_api
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace task_api {
+
+// File names not to download, per chat, from exclusion.ini lines of
+//
+//   <chat id> <name> glob:<pattern> ...
+//
+// Names are matched exactly through a hash set, '*' and '?' included, so
+// entries written before patterns existed keep their meaning. A pattern
+// after "glob:" matches '*' to any run of characters and '?' to one; one
+// whose only wildcard is a trailing '*' is kept as a prefix rule. The
+// rules are an immutable snapshot replaced as a whole when the file's
+// mtime changes, so lookups never wait for a reload.
+class ExclusionEngine {
+ public:
+  ExclusionEngine(const ExclusionEngine& other) = delete;
+  ExclusionEngine& operator=(const ExclusionEngine& other) = delete;
+  ExclusionEngine() : rules_(std::make_shared<const Rules>()) {}
+
+  void load(const std::string& path);
+  bool excluded(int64_t chat_id, const std::string& file_name);
+  // number of chats with rules
+  std::size_t size() const;
+
+ private:
+  struct ChatRules {
+    std::unordered_set<std::string> names;
+    std::vector<std::string> prefixes;
+    std::vector<std::string> globs;
+  };
+  typedef std::unordered_map<int64_t, ChatRules> Rules;
+
+  std::string path_;
+  std::shared_ptr<const Rules> rules_;
+  std::mutex reload_lock_;
+  std::time_t mtime_{0};
+  int64_t file_size_{-1};
+  std::atomic<int64_t> next_check_{0};  // steady clock ticks
+  constexpr static std::chrono::seconds checkInterval{5};
+
+  void reload_if_changed();
+  static bool glob_match(const char* pattern, const char* name);
+};
+}  // namespace task_api
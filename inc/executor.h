@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace task_api {
+
+class TdTask;
+
+// Fixed pool of worker threads running TdTask::step(). Every worker owns a
+// deque: it pops its own work from the back and steals from the front of
+// the others when it runs dry. A task that parks is re-queued by wake(),
+// called when a response arrives, when it is terminated or when the
+// deadline it parked with expires.
+class Executor {
+ public:
+  Executor(const Executor& other) = delete;
+  Executor& operator=(const Executor& other) = delete;
+  // 0 means one worker per core
+  explicit Executor(std::size_t threads = 0);
+  ~Executor();
+
+  void submit(TdTask* task);
+  void wake(TdTask* task);
+  // blocks until the task has returned StepResult::kDone
+  void wait(TdTask* task);
+  std::size_t size() const { return workers_.size(); }
+  // tasks waiting for a worker
+  std::size_t queued() const { return queued_.load(); }
+
+ private:
+  struct Worker {
+    std::mutex lock;
+    std::deque<TdTask*> jobs;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<std::size_t> next_worker_{0};
+  std::atomic<std::size_t> queued_{0};
+  bool stopping_{false};
+  std::mutex idle_lock_;
+  std::condition_variable idle_cv_;
+  std::multimap<std::chrono::steady_clock::time_point, TdTask*> timers_;
+  std::mutex done_lock_;
+  std::condition_variable done_cv_;
+
+  void work(std::size_t index);
+  void enqueue(TdTask* task, bool front);
+  TdTask* take(std::size_t index);
+  void run_step(TdTask* task);
+};
+}  // namespace task_api
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "mpsc_queue.h"
+
+namespace task_api {
+
+enum class LogLevel { kDebug, kInfo, kWarn, kError };
+
+// Process-wide asynchronous log writer. Tasks format a line into their own
+// string and push it onto a lock-free queue; a background thread drains it
+// every flushInterval and writes each sink's lines with one writev. Sinks
+// are rotated to <path>.1 ... <path>.<keep> once they exceed the size limit.
+// Level and rotation come from logging.ini:
+//
+//   level info
+//   rotate_mb 64
+//   rotate_keep 3
+class Logger {
+ public:
+  Logger(const Logger& other) = delete;
+  Logger& operator=(const Logger& other) = delete;
+  ~Logger();
+
+  static Logger& instance();
+
+  void load(const std::string& path);
+  LogLevel level() const { return level_.load(std::memory_order_relaxed); }
+  void set_level(LogLevel level) { level_.store(level, std::memory_order_relaxed); }
+
+  // returns the sink id, -1 when the file cannot be opened
+  int open(const std::string& path);
+  // closes the sink after the lines queued for it are written
+  void close(int sink);
+  // text ends with '\n'
+  void write(int sink, std::string&& text);
+  // blocks until every line queued so far is written
+  void flush();
+
+  // local time as %FT%T, formatted once per second per thread
+  static const std::string& timestamp();
+
+ private:
+  struct Entry {
+    int sink{-1};
+    bool close{false};
+    std::string text;
+  };
+  struct Sink {
+    std::string path;
+    int fd{-1};
+    int64_t size{0};
+  };
+
+  Logger();
+
+  std::atomic<LogLevel> level_{LogLevel::kInfo};
+  std::atomic<int64_t> rotate_size_{64 << 20};
+  std::atomic<int> rotate_keep_{3};
+  MpscQueue<Entry> queue_{queueCapacity};
+  std::mutex lock_;
+  std::condition_variable wakeup_;
+  std::condition_variable flushed_;
+  std::unordered_map<int, std::unique_ptr<Sink>> sinks_;
+  int next_sink_{0};
+  std::atomic<uint64_t> pushed_{0};
+  uint64_t written_{0};
+  bool flush_requested_{false};
+  bool stopping_{false};
+  std::thread writer_;
+  const static std::size_t queueCapacity = 16384;
+  constexpr static std::chrono::milliseconds flushInterval{100};
+
+  void run();
+  void write_batch(std::vector<Entry>& batch);
+  void write_sink(Sink& sink, std::vector<Entry>& batch, std::size_t begin, std::size_t end);
+  void rotate(Sink& sink);
+};
+
+class Log;
+
+// One log line, handed to the Logger when it goes out of scope. Nothing is
+// formatted when the level is filtered out.
+class LogLine {
+ public:
+  LogLine(Log* log, LogLevel level);
+  LogLine(LogLine&& other) : log_(other.log_), text_(std::move(other.text_)) {
+    other.log_ = nullptr;
+  }
+  ~LogLine();
+
+  LogLine& operator<<(const std::string& s) {
+    if (log_ != nullptr) {
+      text_ += s;
+    }
+    return *this;
+  }
+  LogLine& operator<<(const char* s) {
+    if (log_ != nullptr) {
+      text_ += s;
+    }
+    return *this;
+  }
+  LogLine& operator<<(char c) {
+    if (log_ != nullptr) {
+      text_ += c;
+    }
+    return *this;
+  }
+  template <class T, class = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+  LogLine& operator<<(T value) {
+    if (log_ != nullptr) {
+      char buf[32];
+      if constexpr (std::is_integral<T>::value) {
+        text_.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+      }
+      else {
+        text_.append(buf, std::snprintf(buf, sizeof(buf), "%g", static_cast<double>(value)));
+      }
+    }
+    return *this;
+  }
+
+ private:
+  Log* log_;
+  std::string text_;
+};
+
+// A task's log file: log_(LogLevel::kInfo) << "text" << value;
+class Log {
+ public:
+  Log(const Log& other) = delete;
+  Log& operator=(const Log& other) = delete;
+  Log() {}
+  ~Log() { close(); }
+
+  void open(const std::string& path) { sink_ = Logger::instance().open(path); }
+  void close();
+  bool is_open() const { return sink_ >= 0; }
+  LogLine operator()(LogLevel level) { return LogLine(this, level); }
+
+ private:
+  int sink_{-1};
+
+  friend class LogLine;
+};
+}  // namespace task_api
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace task_api {
+
+// Process-wide counters and query latencies. Every thread records into its
+// own shard, so the hot paths take no shared lock: a counter is a relaxed
+// store by its only writer, a latency goes to the shard's histogram of the
+// query's td_api::Function type id under a lock only readers contend for.
+// Readers sum the shards; shards outlive their threads so totals never go
+// back.
+//
+// Histograms are HDR style: 8 linear sub-buckets per power of two of
+// microseconds, so quantiles are within 12.5% from 1us to ~9 hours.
+//
+// Gauges (queue lengths, download slots) are read on demand from callbacks.
+// Everything is written every interval in Prometheus text format to the
+// export file, replaced atomically for a local scraper; TdMain defaults it
+// to metrics.prom in the primary account's database directory.
+// metrics.ini:
+//
+//   file /var/lib/node_exporter/td_downloader.prom
+//   interval 15
+class Metrics {
+ public:
+  enum Counter {
+    kQueriesSent,
+    kResponses,
+    kUpdates,
+    kTaskQueued,    // responses and updates pushed to a TdTask
+    kTaskHandled,   // ... and taken off its queue
+    kBytesDownloaded,
+    kFilesDownloaded,
+    kDownloadErrors,
+    kCounters
+  };
+
+  Metrics(const Metrics& other) = delete;
+  Metrics& operator=(const Metrics& other) = delete;
+  ~Metrics();
+
+  static Metrics& instance();
+
+  void add(Counter counter, int64_t n = 1) {
+    auto& c = shard().counters[counter];
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  // name() returns the name of the type, called once per type and thread
+  template <class Name>
+  void query_sent(int32_t type_id, Name&& name) {
+    Shard& s = shard();
+    auto& c = s.counters[kQueriesSent];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (s.named.insert(type_id).second) {
+      name_type(type_id, name());
+    }
+  }
+  // from the send of a query of the type to the start of its handler
+  void query_latency(int32_t type_id, std::chrono::steady_clock::duration latency);
+  // read is called from the exporter thread and the console, without locks
+  // of Metrics held
+  void gauge(const std::string& name, std::function<int64_t()> read);
+  void remove_gauge(const std::string& name);
+
+  int64_t total(Counter counter);
+  // the name of a query type sent so far, else its id
+  std::string query_name(int32_t type_id);
+  void print(std::ostream& out);
+  void write_prometheus(std::ostream& out);
+
+  void load(const std::string& path);
+  void set_export_file(const std::string& path);
+  // writes the export file every interval until stop_export()
+  void start_export();
+  void stop_export();
+
+ private:
+  // values up to 2^maxExponent us, larger ones land in the last bucket
+  constexpr static int subBits = 3;
+  constexpr static int maxExponent = 35;
+  constexpr static std::size_t buckets = (maxExponent - subBits + 2) << subBits;
+
+  struct Histogram {
+    std::array<uint64_t, buckets> counts{};
+    uint64_t count{0};
+    uint64_t sum_us{0};
+    uint64_t max_us{0};
+
+    void record(uint64_t us);
+    void merge(const Histogram& other);
+    // upper bound of the bucket holding the q quantile, in us
+    uint64_t quantile(double q) const;
+  };
+  struct Shard {
+    std::array<std::atomic<int64_t>, kCounters> counters{};
+    // type ids this thread has named, touched by the owner only
+    std::unordered_set<int32_t> named;
+    std::mutex lock;
+    std::unordered_map<int32_t, Histogram> latencies;
+  };
+
+  Metrics() {}
+
+  std::mutex lock_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::map<int32_t, std::string> names_;
+  std::map<std::string, std::function<int64_t()>> gauges_;
+  std::string export_file_;
+  std::chrono::seconds export_interval_{15};
+  std::thread exporter_;
+  bool stopping_{false};
+  std::condition_variable stop_cv_;
+
+  Shard& shard() {
+    thread_local Shard* current = nullptr;
+    if (current == nullptr) {
+      current = add_shard();
+    }
+    return *current;
+  }
+  Shard* add_shard();
+  void name_type(int32_t type_id, std::string name);
+  // lock_ held
+  std::string type_name(int32_t type_id);
+  std::map<int32_t, Histogram> merged_latencies();
+  std::map<std::string, std::function<int64_t()>> gauges();
+  void write_file();
+};
+}  // namespace task_api
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace task_api {
+
+// Bounded lock-free multi-producer/single-consumer queue (Vyukov's ring with
+// per-cell sequence numbers). When the ring is full, producers spill into a
+// mutex-protected overflow list instead of blocking, so a slow consumer never
+// stalls the producer; items stay in FIFO order per producer.
+template <class T>
+class MpscQueue {
+ public:
+  MpscQueue(const MpscQueue& other) = delete;
+  MpscQueue& operator=(const MpscQueue& other) = delete;
+
+  // capacity is rounded up to a power of two
+  explicit MpscQueue(std::size_t capacity) {
+    std::size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    buffer_ = std::vector<Cell>(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      buffer_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  void push(T&& value) {
+    if (spilled_.load(std::memory_order_acquire) == 0 && try_push(value)) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(spill_lock_);
+    spill_.push_back(std::move(value));
+    spilled_.store(spill_.size(), std::memory_order_release);
+  }
+
+  // consumer only: moves every available item to the end of out
+  std::size_t drain(std::vector<T>& out) {
+    std::size_t count = 0;
+    for (;;) {
+      Cell& cell = buffer_[dequeue_pos_ & mask_];
+      if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+        break;
+      }
+      out.push_back(std::move(cell.data));
+      cell.sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+      ++dequeue_pos_;
+      ++count;
+    }
+
+    // the spill only fills up once the ring is full, so it holds newer items;
+    // take it only when no reserved ring cell is still waiting to be published
+    if (spilled_.load(std::memory_order_acquire) > 0 &&
+        enqueue_pos_.load(std::memory_order_acquire) == dequeue_pos_) {
+      std::lock_guard<std::mutex> lock(spill_lock_);
+      for (auto& value : spill_) {
+        out.push_back(std::move(value));
+      }
+      count += spill_.size();
+      spill_.clear();
+      spilled_.store(0, std::memory_order_release);
+    }
+    return count;
+  }
+
+  // consumer only
+  bool empty() const {
+    const Cell& cell = buffer_[dequeue_pos_ & mask_];
+    return cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1 &&
+           spilled_.load(std::memory_order_acquire) == 0;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<std::size_t> sequence{0};
+    T data;
+  };
+
+  std::vector<Cell> buffer_;
+  std::size_t mask_{0};
+  // producer and consumer positions live on separate cache lines
+  char pad0_[64];
+  std::atomic<std::size_t> enqueue_pos_{0};
+  char pad1_[64];
+  std::size_t dequeue_pos_{0};
+  std::atomic<std::size_t> spilled_{0};
+  std::mutex spill_lock_;
+  std::deque<T> spill_;
+
+  bool try_push(T& value) {
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &buffer_[pos & mask_];
+      std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+};
+}  // namespace task_api
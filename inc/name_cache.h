@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace task_api {
+
+// Up to two names per id (first and last name of a user, or a chat title),
+// for TdMain. Names are interned and reference counted, so the many users
+// sharing a first name keep one copy of it. Entries live in a flat array
+// indexed by an open-addressing table of 32-bit slots and are chained in
+// least recently used order; with a limit set, the least recently used
+// entry is evicted to make room. Thread safe.
+class NameCache {
+ public:
+  NameCache(const NameCache& other) = delete;
+  NameCache& operator=(const NameCache& other) = delete;
+  NameCache() {}
+
+  // 0 keeps every entry
+  void set_limit(std::size_t entries);
+  void put(int64_t id, const std::string& first, const std::string& second = std::string());
+  bool get(int64_t id, std::string& first, std::string& second);
+
+  std::size_t size() const;
+  std::size_t strings() const;
+  std::size_t evictions() const;
+  // approximate bytes held, allocator overhead excluded
+  std::size_t memory() const;
+
+ private:
+  constexpr static uint32_t none = UINT32_MAX;
+  constexpr static std::size_t initialSlots = 16;
+
+  struct Entry {
+    int64_t id;
+    uint32_t first;
+    uint32_t second;
+    // least recently used chain; next links the free entries
+    uint32_t prev;
+    uint32_t next;
+  };
+  struct Interned {
+    std::string text;
+    uint32_t refs{0};
+  };
+
+  mutable std::mutex lock_;
+  std::vector<Entry> entries_;
+  uint32_t free_entry_{none};
+  // entry index or none, the size is a power of two
+  std::vector<uint32_t> slots_;
+  uint32_t head_{none};  // most recently used
+  uint32_t tail_{none};
+  std::size_t size_{0};
+  std::size_t limit_{0};
+  std::size_t evictions_{0};
+  // a deque keeps the texts in place, string_ids_ points into them
+  std::deque<Interned> strings_;
+  std::vector<uint32_t> free_strings_;
+  std::unordered_map<std::string_view, uint32_t> string_ids_;
+  std::size_t string_bytes_{0};
+
+  static std::size_t hash(int64_t id);
+  // the slot holding id, or the empty slot it would go to
+  std::size_t find(int64_t id) const;
+  void erase_slot(std::size_t slot);
+  void grow();
+  void unlink(uint32_t entry);
+  void push_front(uint32_t entry);
+  void evict();
+  uint32_t intern(const std::string& text);
+  void release(uint32_t string);
+};
+}  // namespace task_api
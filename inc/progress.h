@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+
+namespace task_api {
+
+struct ProgressTotals {
+  double rate{0};         // bytes/s
+  int64_t downloaded{0};  // bytes, finished files included
+  int64_t remaining{0};   // bytes left of the running downloads
+  int32_t files{0};
+  int32_t stalled{0};
+
+  // seconds, negative when unknown
+  double eta() const { return rate > 0 ? remaining / rate : (remaining > 0 ? -1 : 0); }
+};
+
+// "<rate> KB/s, <remaining> KB left, eta <n>s, <files> running, <n> stalled"
+std::ostream& operator<<(std::ostream& out, const ProgressTotals& t);
+
+// Size, downloaded bytes and a rolling rate of every running download, fed
+// from updateFile. Trackers register themselves so the figures can be
+// summed up over all Downloaders. Thread safe: status is printed from the
+// console thread.
+class ProgressTracker {
+ public:
+  ProgressTracker(const ProgressTracker& other) = delete;
+  ProgressTracker& operator=(const ProgressTracker& other) = delete;
+  ProgressTracker();
+  ~ProgressTracker();
+
+  // returns the bytes downloaded since the previous update of the file
+  int64_t update(int32_t file_id, int64_t expected_size, int64_t downloaded_size);
+  void remove(int32_t file_id);
+
+  ProgressTotals totals() const;
+  // one line per running download
+  void print(std::ostream& out) const;
+
+  static ProgressTotals global();
+
+ private:
+  struct FileProgress {
+    int64_t expected{0};
+    int64_t downloaded{0};
+    double rate{0};
+    std::chrono::steady_clock::time_point updated;
+  };
+
+  mutable std::mutex lock_;
+  std::unordered_map<int32_t, FileProgress> files_;
+  int64_t downloaded_{0};
+
+  // rate averaging time constant; a file without progress for stallAfter is
+  // reported stalled and its rate decays
+  constexpr static double tau = 10.0;
+  constexpr static std::chrono::seconds stallAfter{15};
+
+  ProgressTotals totals_locked(std::chrono::steady_clock::time_point now) const;
+  static double current_rate(const FileProgress& p, std::chrono::steady_clock::time_point now);
+};
+}  // namespace task_api
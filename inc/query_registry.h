@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace task_api {
+
+// Maps in-flight query ids to the task waiting for the response.
+// Query ids are monotonic, so id & mask spreads them over a power-of-two
+// slot table; a slot is claimed with a CAS on publish and released on
+// retire. Ids whose slot is still held by a much older query fall back to
+// a locked overflow map.
+template <class Owner>
+class QueryRegistry {
+ public:
+  QueryRegistry(const QueryRegistry& other) = delete;
+  QueryRegistry& operator=(const QueryRegistry& other) = delete;
+
+  // capacity is rounded up to a power of two
+  explicit QueryRegistry(std::size_t capacity) {
+    std::size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    slots_.reset(new Slot[size]);
+  }
+
+  // any thread, query_id must not be 0
+  void publish(std::uint64_t query_id, Owner* owner) {
+    Slot& slot = slots_[query_id & mask_];
+    std::uint64_t expected = emptySlot;
+    if (slot.query_id.compare_exchange_strong(expected, busySlot,
+                                              std::memory_order_acquire)) {
+      slot.owner.store(owner, std::memory_order_relaxed);
+      slot.query_id.store(query_id, std::memory_order_release);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(overflow_lock_);
+    overflow_.emplace(query_id, owner);
+    overflow_size_.store(overflow_.size(), std::memory_order_release);
+  }
+
+  // single consumer, returns nullptr for unknown ids
+  Owner* retire(std::uint64_t query_id) {
+    Slot& slot = slots_[query_id & mask_];
+    if (slot.query_id.load(std::memory_order_acquire) == query_id) {
+      Owner* owner = slot.owner.load(std::memory_order_relaxed);
+      slot.query_id.store(emptySlot, std::memory_order_release);
+      return owner;
+    }
+    if (overflow_size_.load(std::memory_order_acquire) == 0) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(overflow_lock_);
+    auto it = overflow_.find(query_id);
+    if (it == overflow_.end()) {
+      return nullptr;
+    }
+    Owner* owner = it->second;
+    overflow_.erase(it);
+    overflow_size_.store(overflow_.size(), std::memory_order_release);
+    return owner;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<std::uint64_t> query_id{emptySlot};
+    std::atomic<Owner*> owner{nullptr};
+  };
+
+  const static std::uint64_t emptySlot = 0;
+  const static std::uint64_t busySlot = ~std::uint64_t{0};
+
+  std::unique_ptr<Slot[]> slots_;
+  std::size_t mask_{0};
+  std::mutex overflow_lock_;
+  std::unordered_map<std::uint64_t, Owner*> overflow_;
+  std::atomic<std::size_t> overflow_size_{0};
+};
+}  // namespace task_api
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace task_api {
+
+// Persistent record of the message id ranges of a chat that were scanned,
+// with every download started from them finished, and of the files done.
+// Kept in <database directory>/<chat id>-scanned.idx as an append-only journal of
+//
+//   r <lo> <hi>
+//   f <file id>
+//
+// lines, flushed one by one; a torn last line is dropped on load. The
+// journal is rewritten (to a temporary file renamed over it) on open and
+// when it grows well beyond the merged contents. Downloaders of the same
+// chat and account share one instance; file ids are local to an account.
+class ScanIndex {
+ public:
+  ScanIndex(const ScanIndex& other) = delete;
+  ScanIndex& operator=(const ScanIndex& other) = delete;
+  ~ScanIndex();
+
+  static std::shared_ptr<ScanIndex> open(int64_t chat_id, const std::string& directory);
+
+  void add_range(int64_t lo, int64_t hi);
+  void add_file(int32_t file_id);
+  // the covered range msg_id falls in, if any
+  bool covered(int64_t msg_id, int64_t& lo, int64_t& hi) const;
+  bool file_done(int32_t file_id) const;
+  // keeps two Downloaders of the chat from downloading the same file at
+  // once; false when it is done or claimed already
+  bool claim_file(int32_t file_id);
+  void release_file(int32_t file_id);
+
+ private:
+  explicit ScanIndex(const std::string& path);
+
+  std::string path_;
+  mutable std::mutex lock_;
+  // lo -> hi, disjoint and not touching
+  std::map<int64_t, int64_t> ranges_;
+  std::unordered_set<int32_t> files_;
+  std::unordered_set<int32_t> claimed_;
+  std::ofstream journal_;
+  std::size_t journal_records_{0};
+  const static std::size_t compactAfter = 4096;
+
+  void load();
+  void insert(int64_t lo, int64_t hi);
+  void compact();
+};
+}  // namespace task_api
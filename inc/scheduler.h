@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+
+#include "concurrency.h"
+
+namespace task_api {
+
+class TdTask;
+
+// Owns the download slots of the whole process. Downloaders register as
+// jobs and submit a ticket per file; a ticket is granted when a slot under
+// the global cap is free, and the job's task is woken. The cap is set by
+// the AIMD controller from the combined throughput of all downloads.
+//
+// Among jobs with waiting tickets the highest priority goes first; a job's
+// priority rises by one for every agingStep its oldest ticket has waited,
+// so low priority jobs are never starved. Within a priority, slots are
+// shared by weight: the job with the fewest running downloads per unit of
+// weight is next.
+class DownloadScheduler {
+ public:
+  struct Ticket {
+    std::atomic<bool> granted{false};
+    int32_t job{0};
+    std::chrono::steady_clock::time_point queued;
+  };
+
+  DownloadScheduler(const DownloadScheduler& other) = delete;
+  DownloadScheduler& operator=(const DownloadScheduler& other) = delete;
+
+  static DownloadScheduler& instance();
+
+  int32_t add_job(TdTask* task, int32_t weight, int32_t priority);
+  // drops the job's waiting tickets and frees its slots
+  void remove_job(int32_t job);
+  std::shared_ptr<Ticket> submit(int32_t job);
+  // the download finished or failed, or the ticket is no longer wanted
+  void release(const std::shared_ptr<Ticket>& ticket);
+
+  void on_progress(int64_t bytes);
+  void on_complete(std::chrono::steady_clock::duration latency, int64_t size);
+  void on_error();
+
+  int32_t cap();
+  int32_t running();
+  std::size_t waiting();
+  void print_status(std::ostream& out);
+
+ private:
+  struct Job {
+    TdTask* task;
+    int32_t weight;
+    int32_t priority;
+    int32_t running{0};
+    std::deque<std::shared_ptr<Ticket>> waiting;
+  };
+
+  DownloadScheduler();
+
+  std::mutex lock_;
+  std::map<int32_t, Job> jobs_;
+  int32_t next_job_{0};
+  int32_t running_{0};
+  ConcurrencyController controller_;
+  constexpr static std::chrono::seconds agingStep{60};
+
+  void dispatch();
+  // lock_ held
+  std::size_t waiting_tickets() const;
+  Job* pick(std::chrono::steady_clock::time_point now);
+};
+}  // namespace task_api
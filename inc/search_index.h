@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace task_api {
+
+// Local full-text index of message texts, captions and file names, so
+// chats can be searched together without asking TDLib. Terms are ASCII
+// words, lower cased, and single non-ASCII characters (captions are often
+// Chinese, which has no word breaks); a query matches the messages that
+// contain all its terms. Terms are kept as 64-bit hashes and their posting
+// lists as varint coded deltas of ascending document numbers.
+//
+// search.idx in the primary account's database directory holds a snapshot
+// of the documents (chat id, message id, a snippet of the text) and the
+// term dictionary. Documents added since are appended to search.log next
+// to it, replayed on open; a new snapshot is
+// written (to a temporary file renamed over it) when the journal is long
+// and on exit. Process-wide and thread safe.
+class SearchIndex {
+ public:
+  struct Hit {
+    int64_t chat_id;
+    int64_t msg_id;
+    std::string snippet;
+  };
+
+  SearchIndex(const SearchIndex& other) = delete;
+  SearchIndex& operator=(const SearchIndex& other) = delete;
+  // the process-wide index is instance(), tests open their own
+  SearchIndex(const std::string& snapshot_path, const std::string& journal_path);
+  ~SearchIndex();
+
+  static SearchIndex& instance();
+  // the directory of the index files, set before the first instance()
+  static void set_directory(const std::string& directory);
+
+  // a message is indexed once, later calls for it are ignored
+  void add(int64_t chat_id, int64_t msg_id, const std::string& text);
+  // most recently indexed first; chat_id 0 searches every chat
+  std::vector<Hit> search(const std::string& query, std::size_t limit, int64_t chat_id = 0);
+  std::size_t documents();
+  std::size_t terms();
+
+ private:
+  struct Document {
+    int64_t chat_id;
+    int64_t msg_id;
+    std::string snippet;
+  };
+  struct Postings {
+    std::string deltas;
+    uint32_t last{0};  // document number of the last posting
+    uint32_t count{0};
+  };
+
+  static std::string& directory();
+
+  std::string snapshot_path_;
+  std::string journal_path_;
+  std::mutex lock_;
+  // document number n is documents_[n - 1]
+  std::vector<Document> documents_;
+  std::unordered_map<uint64_t, Postings> terms_;
+  // hashes of the (chat id, message id) pairs indexed
+  std::unordered_set<uint64_t> messages_;
+  std::ofstream journal_;
+  std::size_t journal_records_{0};
+  const static std::size_t snapshotAfter = 1 << 16;
+  const static std::size_t snippetLength = 96;
+
+  void load();
+  bool index(int64_t chat_id, int64_t msg_id, const std::string& text);
+  void write_snapshot();
+  static void decode(const Postings& postings, std::vector<uint32_t>& out);
+};
+}  // namespace task_api
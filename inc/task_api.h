@@ -3,6 +3,9 @@
 #include <td/telegram/Client.h>
 #include <td/telegram/td_api.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <fstream>
 #include <functional>
@@ -10,10 +13,31 @@
 #include <map>
 #include <mutex>
 #include <td/telegram/td_api.hpp>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <thread>
 
+#include "chat_snapshot.h"
+#include "column_file.h"
+#include "concurrency.h"
+#include "dedup_index.h"
+#include "exclusions.h"
+#include "executor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "name_cache.h"
+#include "mpsc_queue.h"
+#include "progress.h"
+#include "query_registry.h"
+#include "scheduler.h"
+#include "scan_index.h"
+#include "search_index.h"
+#include "td_coro.h"
+#include "text.h"
+#include "tracer.h"
+#include "transport.h"
+
 // overloaded
 namespace detail {
 template <class... Fs>
@@ -40,89 +64,255 @@ auto overloaded(F... f) {
 namespace td_api = td::td_api;
 using Object = td_api::object_ptr<td_api::Object>;
 
+// the text, caption and file name of a message, as fed to SearchIndex
+inline std::string searchable_text(const td_api::message& m) {
+  const td_api::MessageContent& content = *m.content_;
+  switch (content.get_id()) {
+    case td_api::messageText::ID:
+      return static_cast<const td_api::messageText&>(content).text_->text_;
+    case td_api::messagePhoto::ID:
+      return static_cast<const td_api::messagePhoto&>(content).caption_->text_;
+    case td_api::messageVideo::ID: {
+      auto& mv = static_cast<const td_api::messageVideo&>(content);
+      return mv.caption_->text_ + " " + mv.video_->file_name_;
+    }
+    case td_api::messageDocument::ID: {
+      auto& md = static_cast<const td_api::messageDocument&>(content);
+      return md.caption_->text_ + " " + md.document_->file_name_;
+    }
+    default:
+      return std::string();
+  }
+}
+
 class Task {
  public:
   virtual void run() = 0;
-  void terminate() { terminate_ = true; }
+  virtual void terminate() { terminate_ = true; }
   virtual void print_status() = 0;
   virtual ~Task() {}
 
  protected:
-  bool terminate_{false};
+  std::atomic<bool> terminate_{false};
 };
 
 class TdTask;
 
+// Runs the accounts listed at construction under one transport and one
+// receive loop. Every account has its own TDLib client and database
+// directory; responses and updates are routed by their client id, and
+// query ids are unique across accounts.
 class ClientWrapper : public Task {
  public:
   ClientWrapper(const ClientWrapper& other) = delete;
   ClientWrapper& operator=(const ClientWrapper& other) = delete;
-  ClientWrapper();
+  ClientWrapper(std::unique_ptr<Transport> transport,
+                const std::vector<std::string>& database_directories);
   virtual ~ClientWrapper() {}
 
   std::uint64_t next_query_id();
 
-  bool need_restart() const { return need_restart_; }
+  // true once any account was closed
+  bool need_restart() const;
 
-  bool authenticated() const { return are_authorized_; }
+  // true once every account is authorized
+  bool authenticated() const;
+  bool authorized(std::int32_t account) const { return accounts_[account].authorized; }
+  std::int32_t accounts() const { return static_cast<std::int32_t>(accounts_.size()); }
+  const std::string& database_directory(std::int32_t account) const {
+    return accounts_[account].database_directory;
+  }
+  // accounts that received updateNewChat for the chat
+  std::vector<std::int32_t> accounts_with_chat(std::int64_t chat_id);
 
   void send_query(std::uint64_t query_id,
-                  td_api::object_ptr<td_api::Function> f, TdTask* task);
-  void subscribe_update(std::int32_t type_id, TdTask* task);
+                  td_api::object_ptr<td_api::Function> f, TdTask* task,
+                  std::int32_t account = 0);
+  // every subscriber of an update type gets the updates of that type, the
+  // extra ones a copy_object() of it
+  void subscribe_update(std::int32_t type_id, TdTask* task, std::int32_t account = 0);
+  void unsubscribe_update(std::int32_t type_id, TdTask* task, std::int32_t account = 0);
+  // sends the updateFile of file_id to task only, ahead of subscribers
+  void route_file(std::int32_t file_id, TdTask* task, std::int32_t account = 0);
+  void unroute_file(std::int32_t file_id, std::int32_t account = 0);
   void run();
-  void print_status() {
-    std::cout << "To be implemented..." << std::endl;
-  }
+  void terminate();
+  void print_status();
 
  private:
-  std::unique_ptr<td::ClientManager> client_manager_;
-  std::int32_t client_id_{0};
-
-  td_api::object_ptr<td_api::AuthorizationState> authorization_state_;
-  bool are_authorized_{false};
-  bool need_restart_{false};
-  std::uint64_t current_query_id_{0};
-  std::uint64_t authentication_query_id_{0};
-  std::mutex query_id_lock_;
-  std::mutex response_registry_lock_;
+  struct Account {
+    std::string database_directory;
+    std::int32_t client_id{0};
+    td_api::object_ptr<td_api::AuthorizationState> authorization_state;
+    bool authorized{false};
+    bool closed{false};
+    std::uint64_t authentication_query_id{0};
+  };
+
+  std::unique_ptr<Transport> transport_;
+  std::vector<Account> accounts_;
+  // TDLib client id -> index into accounts_
+  std::unordered_map<std::int32_t, std::int32_t> account_by_client_;
+  std::atomic<std::uint64_t> current_query_id_{0};
   std::mutex update_registry_lock_;
-  std::map<std::uint64_t, TdTask*> response_registry_;
-  std::map<std::int32_t, TdTask*> update_registry_;
+  QueryRegistry<TdTask> response_registry_{registryCapacity};
+  // (account, update type id) -> subscribers
+  std::map<std::pair<std::int32_t, std::int32_t>, std::vector<TdTask*>> update_registry_;
+  // file_key(account, file id) -> owner of the download
+  std::unordered_map<std::uint64_t, TdTask*> file_routes_;
+  // update types copy_object() returned null for, reported once; under
+  // update_registry_lock_
+  std::unordered_set<std::int32_t> uncopied_updates_;
   std::map<std::uint64_t, std::function<void(Object)>> handlers_;
-
-  void receive_and_dispatch();
-  void process_update(Object update);
-  void on_authorization_state_update();
-  auto create_authentication_query_handler();
-  void check_authentication_error(Object object);
-  void send_authentication_query(td_api::object_ptr<td_api::Function> f,
+  std::mutex chats_lock_;
+  // chat id -> bit set of the accounts that can access it
+  std::unordered_map<std::int64_t, std::uint64_t> chat_accounts_;
+  // upper bound of a single blocking receive, terminate() wakes it earlier
+  constexpr static double receiveTimeout = 30.0;
+  const static std::size_t registryCapacity = 1 << 16;
+  const static std::size_t maxAccounts = 64;
+
+  static std::uint64_t file_key(std::int32_t account, std::int32_t file_id) {
+    return (static_cast<std::uint64_t>(account) << 32) | static_cast<std::uint32_t>(file_id);
+  }
+  void receive_and_dispatch(double timeout);
+  void dispatch(td::ClientManager::Response response);
+  void process_update(std::int32_t account, Object update);
+  void on_authorization_state_update(std::int32_t account);
+  auto create_authentication_query_handler(std::int32_t account);
+  void check_authentication_error(std::int32_t account, Object object);
+  void send_authentication_query(std::int32_t account,
+                                 td_api::object_ptr<td_api::Function> f,
                                  std::function<void(Object)> handler);
 };
 
+enum class StepResult { kYield, kPark, kDone };
+
 class TdTask : public Task {
  public:
-  TdTask(ClientWrapper* client_ptr);
-  virtual ~TdTask() {}
+  TdTask(ClientWrapper* client_ptr, std::int32_t account = 0);
+  virtual ~TdTask() { destroy_coroutines(); }
   void accept_response(td::ClientManager::Response response);
+  void terminate();
+  // runs step() on the calling thread, waiting for responses while parked
+  virtual void run();
+  // does the work available without blocking; on kPark the task sleeps until
+  // a response arrives, it is terminated or wake_at_ passes
+  virtual StepResult step() { return StepResult::kDone; }
+  // runs the task again from another thread, so its wait_until conditions
+  // are re-checked; on a dedicated thread it ends wait_for_responses
+  void wake() {
+    woken_.store(true);
+    notify();
+  }
+  // the ClientWrapper account the task's queries go to
+  std::int32_t account() const { return account_; }
+  // true once step() returned StepResult::kDone on an Executor
+  bool done() const { return sched_state_.load() == kDone; }
 
  protected:
   ClientWrapper* client_ptr_;
-  std::map<std::uint64_t, std::function<void(Object)>> handlers_;
-  std::deque<td::ClientManager::Response> responses_;
-  std::mutex queue_lock_;
-
-  void process_responses();
+  std::int32_t account_;
+  std::atomic<Executor*> executor_{nullptr};
+  std::chrono::steady_clock::time_point wake_at_{
+    std::chrono::steady_clock::time_point::max()};
+  struct PendingQuery {
+    std::function<void(Object)> handler;
+    // for the latency metrics of the query type
+    std::int32_t type_id;
+    std::chrono::steady_clock::time_point sent;
+  };
+  std::map<std::uint64_t, PendingQuery> handlers_;
+  struct QueuedResponse {
+    td::ClientManager::Response response;
+    // set while tracing only
+    std::chrono::steady_clock::time_point queued;
+  };
+  MpscQueue<QueuedResponse> responses_{queueCapacity};
+  // batch drained from responses_, handlers run on it without holding any lock
+  std::vector<QueuedResponse> batch_;
+  std::mutex wait_lock_;
+  std::condition_variable responses_available_;
+  std::atomic<bool> waiting_{false};
+  std::atomic<bool> woken_{false};
+  const static std::size_t queueCapacity = 4096;
+
+  // returns the number of responses and updates handled
+  std::size_t process_responses();
+  // blocks until a response arrives, the task is terminated or woken, or
+  // deadline passes
+  void wait_for_responses(std::chrono::steady_clock::time_point deadline);
   virtual void process_update(Object& update) = 0;
 
   void send_query(td_api::object_ptr<td_api::Function> f,
                   std::function<void(Object)> handler) {
     std::uint64_t qryid = client_ptr_->next_query_id();
     if (handler) {
-      handlers_.emplace(qryid, handler);
+      handlers_.emplace(qryid, PendingQuery{std::move(handler), f->get_id(),
+        std::chrono::steady_clock::now()});
     }
 
-    client_ptr_->send_query(qryid, std::move(f), this);
+    client_ptr_->send_query(qryid, std::move(f), this, account_);
+  }
+
+  // awaitables for Coroutine members, resumed from process_responses()
+  template <class T>
+  QueryAwaiter<T, TdTask> query(td_api::object_ptr<td_api::Function> f) {
+    return QueryAwaiter<T, TdTask>(this, std::move(f));
+  }
+  FileAwaiter<TdTask> file_completed(std::int32_t file_id) {
+    return FileAwaiter<TdTask>(this, file_id);
+  }
+  SleepAwaiter<TdTask> sleep_until(std::chrono::steady_clock::time_point deadline) {
+    return SleepAwaiter<TdTask>(this, deadline);
+  }
+  ConditionAwaiter<TdTask> wait_until(std::function<bool()> pred) {
+    return ConditionAwaiter<TdTask>(this, std::move(pred));
+  }
+  // earliest sleep_until deadline, for wake_at_
+  std::chrono::steady_clock::time_point next_timer() const {
+    return timers_.empty() ? std::chrono::steady_clock::time_point::max()
+                           : timers_.begin()->first;
+  }
+  bool has_coroutines() const { return !suspended_.empty(); }
+  // frees every suspended coroutine and forgets the queries they wait for
+  void destroy_coroutines();
+
+ private:
+  template <class T, class O> friend class QueryAwaiter;
+  template <class O> friend class FileAwaiter;
+  template <class O> friend class SleepAwaiter;
+  template <class O> friend class ConditionAwaiter;
+  // frame addresses of suspended coroutines
+  std::unordered_set<void*> suspended_;
+  std::unordered_map<std::int32_t, std::function<void(td_api::object_ptr<td_api::file>)>>
+    file_waiters_;
+  std::multimap<std::chrono::steady_clock::time_point, std::coroutine_handle<>> timers_;
+  std::vector<std::pair<std::function<bool()>, std::coroutine_handle<>>> conditions_;
+
+  void suspend(std::coroutine_handle<> handle) { suspended_.insert(handle.address()); }
+  void resume(std::coroutine_handle<> handle) {
+    suspended_.erase(handle.address());
+    handle.resume();
+  }
+  void add_file_waiter(std::int32_t file_id,
+                       std::function<void(td_api::object_ptr<td_api::file>)> waiter) {
+    file_waiters_[file_id] = std::move(waiter);
   }
+  void add_timer(std::chrono::steady_clock::time_point deadline,
+                 std::coroutine_handle<> handle) {
+    timers_.emplace(deadline, handle);
+  }
+  void add_condition(std::function<bool()> pred, std::coroutine_handle<> handle) {
+    conditions_.emplace_back(std::move(pred), handle);
+  }
+  bool complete_file_waiter(Object& update);
+  void resume_ready();
+
+  friend class Executor;
+  enum SchedState { kParked, kQueued, kRunning, kNotified, kDone };
+  std::atomic<int> sched_state_{kParked};
+  void notify();
 };
 
 class Downloader : public TdTask {
@@ -130,18 +320,10 @@ class Downloader : public TdTask {
   Downloader(const Downloader& other) = delete;
   Downloader& operator=(const Downloader& other) = delete;
   Downloader(int64_t chat, const std::string& title, int64_t msg, int32_t limit, int32_t direction,
-             ClientWrapper* client_ptr);
+             ClientWrapper* client_ptr, int32_t weight = 1, int32_t priority = 0,
+             int32_t account = 0);
 
-  ~Downloader() {
-    if (log_.is_open()) {
-      log_.close();
-    }
-  }
-
-  void run() { 
-    auto_download();
-    log_.close();
-  }
+  StepResult step();
 
   void process_update(Object& update);
 
@@ -154,27 +336,77 @@ class Downloader : public TdTask {
   int32_t limit_;
   std::unordered_set<int32_t> downloading_files_;
   std::unordered_set<int32_t> downloaded_files_;
-  std::ofstream log_;
+  Log log_;
   int32_t direction_{1};
   bool up_to_date_{ false };
-  const static int32_t nightModeLimit = 5;
-  const static int32_t daytimeModeLimit = 2;
-
-  void auto_download();
-  void retrieve_more_msg();
+  bool last_msg_handled_{ false };
+  bool started_{ false };
+  bool scanning_{ false };
+  std::chrono::steady_clock::time_point retry_at_;
+  // slot-seconds spent waiting with free download slots / all waiting slot-seconds
+  double slot_idle_time_{0};
+  double slot_time_{0};
+  std::chrono::steady_clock::time_point parked_at_;
+  int32_t parked_slots_{0};
+  int32_t parked_busy_{0};
+  // DownloadScheduler job
+  int32_t job_;
+  ProgressTracker progress_;
+  std::shared_ptr<ScanIndex> index_;
+  // DedupIndex keys of the running downloads
+  std::unordered_map<int32_t, uint64_t> dedup_keys_;
+  // a page of scanned history; its range goes into index_ once every
+  // download started from it has finished
+  struct Page {
+    int64_t lo{INT64_MAX};
+    int64_t hi{INT64_MIN};
+    int32_t pending{0};
+    bool scanned{false};
+    bool failed{false};
+  };
+  std::map<int32_t, Page> pages_;
+  // videos found by the history scan, not yet submitted for download
+  struct Candidate {
+    int32_t file_id;
+    std::string caption;
+    int64_t msg_id;
+    int32_t page;
+  };
+  std::deque<Candidate> candidates_;
+  const static int32_t pageSize = 100;
+  const static std::size_t maxCandidates = 1000;
+  int32_t page_{0};  // the page being scanned
+  int32_t last_page_{0};
+  // lower bound recorded once a backward scan reaches the first message
+  const static int64_t chatStart = 1;
+  constexpr static std::chrono::minutes retryInterval{2};
+
+  void finish();
+  void account_idle_slots();
+  // whether the history scan may fetch another page
+  bool scan_ahead();
+  // moves candidates_ to the scheduler as far as the slots allow
+  void start_downloads();
+  Coroutine scan_history();
+  Coroutine download(int32_t file_id, std::string caption, int64_t msg_id, int32_t page);
+  // frees what download() holds for a file it gave up on; its page is
+  // scanned again by a later run
+  void fail_download(int32_t file_id, int32_t page,
+                     const std::shared_ptr<DownloadScheduler::Ticket>& ticket);
+  // moves last_msg_id_ past scanned history, true when nothing is left
+  bool skip_scanned();
+  int32_t open_page(int64_t anchor, bool anchored);
+  void close_page(int32_t page);
+  void commit_page(int32_t page);
   void do_download_if_video(const td_api::object_ptr<td_api::message>& mptr);
   int32_t get_concurrent_limit();
-  std::string get_current_timestamp() {
-    char res[20];
-    time_t t = time(nullptr);
-    std::strftime(res, sizeof(res), "%FT%T", localtime(&t));
-    return std::string(res);
-  }
+  void track_progress(const td_api::file& file);
 
-  bool log_msg_if_error(const Object& object, std::string&& msg) {
-    if (object->get_id() == td_api::error::ID) {
-      log_ << "ERROR: " << msg << static_cast<const td_api::error&>(*object).message_
-        << std::endl;
+  template <class T>
+  bool log_msg_if_error(const QueryResult<T>& result, std::string&& msg) {
+    if (!result.ok()) {
+      retry_at_ = std::chrono::steady_clock::now() + retryInterval;
+      log_(LogLevel::kError) << msg << result.error();
       return true;
     }
 
@@ -182,24 +414,99 @@ class Downloader : public TdTask {
   }
 };
 
+// Pages through the main chat list of an account with loadChats until
+// TDLib reports it complete, so updateNewChat arrives for every chat.
+class ChatLoader : public TdTask {
+ public:
+  ChatLoader(ClientWrapper* client_ptr, std::int32_t account);
+
+  StepResult step();
+
+  void print_status();
+
+ private:
+  bool started_{false};
+  bool loaded_{false};
+  std::int32_t pages_{0};
+  constexpr static std::int32_t pageSize = 100;
+  constexpr static std::chrono::seconds retryInterval{30};
+
+  Coroutine load();
+  void process_update(Object&) {}
+};
+
+// Writes the history of a chat, newest message first, to a column file.
+// The next page is requested before the current one is written, so the
+// file is written while TDLib fetches; only one page and one row group
+// are held at a time.
+class HistoryExporter : public TdTask {
+ public:
+  HistoryExporter(std::int64_t chat_id, const std::string& path, std::int64_t from_msg_id,
+                  std::int64_t limit, ClientWrapper* client_ptr, std::int32_t account = 0);
+
+  StepResult step();
+
+  void print_status();
+
+ private:
+  std::int64_t chat_id_;
+  std::string path_;
+  std::int64_t from_msg_id_;
+  std::int64_t limit_;
+  ColumnFileWriter writer_;
+  bool started_{false};
+  bool finished_{false};
+  // the page requested ahead
+  Object next_page_;
+  bool next_ready_{false};
+  std::chrono::steady_clock::time_point started_at_;
+  constexpr static std::int32_t pageSize = 100;
+  constexpr static std::chrono::seconds retryInterval{30};
+
+  Coroutine export_history();
+  void request_page(std::int64_t from_msg_id);
+  void write_row(const td_api::message& m);
+  void process_update(Object&) {}
+};
+
 class TdMain : public TdTask {
  public:
-  TdMain();
+  explicit TdMain(std::unique_ptr<Transport> transport);
   ~TdMain();
   virtual void run();
-  void print_status() {
-    std::cout << "To be implemented..." << std::endl;
-  }
+  void print_status();
 
  private:
-  std::map<std::int64_t, td_api::object_ptr<td_api::user>> users_;
-  std::map<std::int64_t, std::string> chat_title_;
+  // first and last names of users, titles of chats
+  NameCache users_;
+  NameCache chat_title_;
+  // titles of the previous runs, in the primary account's directory
+  std::unique_ptr<ChatSnapshot> chat_snapshot_;
+  bool console_started_{false};
+  // lines read by the console thread, handled by run()
+  std::mutex console_lock_;
+  std::deque<std::string> console_lines_;
+  // how often run() re-checks the authorization state
+  constexpr static std::chrono::seconds authPollInterval{5};
   std::vector<std::thread> workers_;
   std::vector<Task*> task_handles_;
+  Executor executor_;
+  std::vector<TdTask*> scheduled_;
 
   void process_update(Object& update);
   void terminate();
+  // the console thread: reads stdin line by line until "q" or its end
+  void read_console();
+  void print_help();
+  void print_prompt() { std::cout << "> " << std::flush; }
+  // false when the command quits
+  bool handle_command(const std::string& line);
+  // runs the task on a dedicated thread, for tasks that block (the client)
   void launch_task(Task* task);
+  void schedule_task(TdTask* task);
+  // the authorized account with access to the chat running the fewest
+  // downloaders, the primary account when none is known to have it
+  std::int32_t pick_account(std::int64_t chat_id);
 
   void print_msg_content(td_api::object_ptr<td_api::MessageContent>& ptr) {
     std::string text;
@@ -237,20 +544,20 @@ class TdMain : public TdTask {
     std::cout << std::endl;
   }
 
-  std::string get_user_name(std::int64_t user_id) const {
-    auto it = users_.find(user_id);
-    if (it == users_.end()) {
+  std::string get_user_name(std::int64_t user_id) {
+    std::string first, last;
+    if (!users_.get(user_id, first, last)) {
       return "unknown user";
     }
-    return it->second->first_name_ + " " + it->second->last_name_;
+    return first + " " + last;
   }
 
-  std::string get_chat_title(std::int64_t chat_id) const {
-    auto it = chat_title_.find(chat_id);
-    if (it == chat_title_.end()) {
+  std::string get_chat_title(std::int64_t chat_id) {
+    std::string title, unused;
+    if (!chat_title_.get(chat_id, title, unused)) {
       return "unknown chat";
     }
-    return it->second;
+    return title;
   }
   
   void stop_tasks(bool terminating) {
@@ -264,6 +571,9 @@ class TdMain : public TdTask {
     for (auto it = task_handles_.rbegin(); it < task_end; ++it) {
       (*it)->terminate();
     }
+    for (auto task : scheduled_) {
+      executor_.wait(task);
+    }
     for (auto it = workers_.rbegin(); it < worker_end; ++it) {
       if (it->joinable()) {
         it->join();
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <td/telegram/td_api.h>
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+#include <utility>
+
+namespace task_api {
+
+// Fire-and-forget coroutine, started eagerly. Its frame is freed when it
+// returns; the owning TdTask destroys it if it is still suspended when the
+// task finishes. Only awaiters from this header may be awaited in it.
+struct Coroutine {
+  struct promise_type {
+    Coroutine get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// Response of an awaited query: the expected object or td_api::error.
+template <class T>
+class QueryResult {
+ public:
+  explicit QueryResult(td::td_api::object_ptr<td::td_api::Object> object)
+      : object_(std::move(object)) {}
+
+  bool ok() const {
+    return object_ && object_->get_id() != td::td_api::error::ID;
+  }
+  // only when ok()
+  td::td_api::object_ptr<T> value() {
+    return td::move_tl_object_as<T>(object_);
+  }
+  // only when !ok()
+  std::string error() const {
+    if (!object_) {
+      return "no response";
+    }
+    return static_cast<const td::td_api::error&>(*object_).message_;
+  }
+  // only when !ok(), 0 for no response
+  std::int32_t error_code() const {
+    return object_ ? static_cast<const td::td_api::error&>(*object_).code_ : 0;
+  }
+
+ private:
+  td::td_api::object_ptr<td::td_api::Object> object_;
+};
+
+// co_await query<T>(f): sends f, resumes with its response
+template <class T, class Owner>
+class QueryAwaiter {
+ public:
+  QueryAwaiter(Owner* owner, td::td_api::object_ptr<td::td_api::Function> f)
+      : owner_(owner), f_(std::move(f)) {}
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    owner_->suspend(handle);
+    owner_->send_query(std::move(f_),
+      [this, handle](td::td_api::object_ptr<td::td_api::Object> object) {
+        result_ = std::move(object);
+        owner_->resume(handle);
+      });
+  }
+  QueryResult<T> await_resume() { return QueryResult<T>(std::move(result_)); }
+
+ private:
+  Owner* owner_;
+  td::td_api::object_ptr<td::td_api::Function> f_;
+  td::td_api::object_ptr<td::td_api::Object> result_;
+};
+
+// co_await file_completed(id): resumes with the file once updateFile reports
+// it fully downloaded, or no longer downloading (failed or cancelled)
+template <class Owner>
+class FileAwaiter {
+ public:
+  FileAwaiter(Owner* owner, std::int32_t file_id)
+      : owner_(owner), file_id_(file_id) {}
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    owner_->suspend(handle);
+    owner_->add_file_waiter(file_id_, [this, handle](td::td_api::object_ptr<td::td_api::file> file) {
+      file_ = std::move(file);
+      owner_->resume(handle);
+    });
+  }
+  td::td_api::object_ptr<td::td_api::file> await_resume() {
+    return std::move(file_);
+  }
+
+ private:
+  Owner* owner_;
+  std::int32_t file_id_;
+  td::td_api::object_ptr<td::td_api::file> file_;
+};
+
+// co_await sleep_until(t)
+template <class Owner>
+class SleepAwaiter {
+ public:
+  SleepAwaiter(Owner* owner, std::chrono::steady_clock::time_point deadline)
+      : owner_(owner), deadline_(deadline) {}
+
+  bool await_ready() const noexcept {
+    return std::chrono::steady_clock::now() >= deadline_;
+  }
+  void await_suspend(std::coroutine_handle<> handle) {
+    owner_->suspend(handle);
+    owner_->add_timer(deadline_, handle);
+  }
+  void await_resume() {}
+
+ private:
+  Owner* owner_;
+  std::chrono::steady_clock::time_point deadline_;
+};
+
+// co_await wait_until(pred): pred is re-checked after every batch of
+// responses the owner processes
+template <class Owner>
+class ConditionAwaiter {
+ public:
+  ConditionAwaiter(Owner* owner, std::function<bool()> pred)
+      : owner_(owner), pred_(std::move(pred)) {}
+
+  bool await_ready() const { return pred_(); }
+  void await_suspend(std::coroutine_handle<> handle) {
+    owner_->suspend(handle);
+    owner_->add_condition(pred_, handle);
+  }
+  void await_resume() {}
+
+ private:
+  Owner* owner_;
+  std::function<bool()> pred_;
+};
+}  // namespace task_api
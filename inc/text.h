@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+namespace task_api {
+
+// Normalizes a caption or a path in place, in a single pass: '[' and ']'
+// become '(' and ')' so the text can be logged between brackets, and with
+// collapse_space every run of ASCII whitespace becomes one ' '. Bytes of
+// multi-byte UTF-8 sequences are >= 0x80 and never touched.
+void normalize_text(std::string& s, bool collapse_space);
+}  // namespace task_api
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace task_api {
+
+// A timed span for Tracer::record.
+struct TraceSpan {
+  // a query type id names the span when name is null
+  const char* name{nullptr};
+  int32_t type_id{0};
+  const char* category{""};
+  // async spans may begin and end on different threads, id is unique
+  // within the category; the others are drawn on the recording thread
+  bool async{false};
+  uint64_t id{0};
+  std::chrono::steady_clock::time_point begin{};
+  std::chrono::steady_clock::time_point end{};
+  // an optional argument shown with the span
+  const char* arg_name{nullptr};
+  int64_t arg{0};
+};
+
+// Optional recorder of spans for chrome://tracing and Perfetto. While on,
+// every thread appends to its own ring of the last ringEvents spans, which
+// stop() writes as trace event JSON. The ring of an exited thread keeps its
+// spans and is handed to the next new thread, so there are never more
+// rings than threads alive at once. While off, callers only pay for the
+// relaxed load of enabled(), so checks stay on the hot paths.
+class Tracer {
+ public:
+  Tracer(const Tracer& other) = delete;
+  Tracer& operator=(const Tracer& other) = delete;
+
+  static Tracer& instance();
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // drops the spans recorded so far
+  void start();
+  // returns the number of spans written, -1 when the file can't be written
+  int64_t stop(const std::string& path);
+  void record(const TraceSpan& span);
+  // an id for async spans of categories without a natural one
+  uint64_t next_id() { return next_id_.fetch_add(1, std::memory_order_relaxed); }
+
+ private:
+  struct Entry {
+    TraceSpan span;
+    int32_t tid;
+  };
+  struct Ring {
+    std::mutex lock;
+    int32_t tid{0};
+    std::vector<Entry> entries;
+    std::size_t next{0};
+    bool wrapped{false};
+  };
+  // returns the ring of its thread to the tracer when the thread exits
+  struct RingOwner {
+    Ring* ring{nullptr};
+    ~RingOwner();
+  };
+
+  Tracer() : epoch_(std::chrono::steady_clock::now()) {}
+
+  inline static std::atomic<bool> enabled_{false};
+  std::chrono::steady_clock::time_point epoch_;
+  std::atomic<uint64_t> next_id_{1};
+  std::mutex lock_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+  // rings of exited threads
+  std::vector<Ring*> free_rings_;
+  int32_t next_tid_{0};
+  const static std::size_t ringEvents = 1 << 15;
+
+  Ring& ring();
+  void release(Ring* ring);
+};
+
+// Records a span on the calling thread from construction to destruction,
+// when tracing was on at construction.
+class TraceScope {
+ public:
+  TraceScope(const TraceScope& other) = delete;
+  TraceScope& operator=(const TraceScope& other) = delete;
+  explicit TraceScope(const TraceSpan& span) : active_(Tracer::enabled()) {
+    if (active_) {
+      span_ = span;
+      span_.begin = std::chrono::steady_clock::now();
+    }
+  }
+  ~TraceScope() {
+    if (active_) {
+      span_.end = std::chrono::steady_clock::now();
+      Tracer::instance().record(span_);
+    }
+  }
+
+ private:
+  bool active_;
+  TraceSpan span_;
+};
+}  // namespace task_api
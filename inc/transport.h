@@ -0,0 +1,122 @@
+#pragma once
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace task_api {
+
+// What ClientWrapper talks to: the TDLib client manager, or a recorder or
+// replayer standing in for it.
+class Transport {
+ public:
+  virtual ~Transport() {}
+  virtual std::int32_t create_client_id() = 0;
+  virtual void send(std::int32_t client_id, std::uint64_t request_id,
+                    td::td_api::object_ptr<td::td_api::Function> f) = 0;
+  // blocks up to timeout seconds, object is null when nothing arrived
+  virtual td::ClientManager::Response receive(double timeout) = 0;
+};
+
+// Copy of the fields of object that TaskApi reads, made with the
+// recording codec; other fields are left default.
+td::td_api::object_ptr<td::td_api::Object> copy_object(const td::td_api::Object& object);
+
+class TdTransport : public Transport {
+ public:
+  TdTransport() : client_manager_(std::make_unique<td::ClientManager>()) {}
+
+  std::int32_t create_client_id() { return client_manager_->create_client_id(); }
+  void send(std::int32_t client_id, std::uint64_t request_id,
+            td::td_api::object_ptr<td::td_api::Function> f) {
+    client_manager_->send(client_id, request_id, std::move(f));
+  }
+  td::ClientManager::Response receive(double timeout) {
+    return client_manager_->receive(timeout);
+  }
+
+ private:
+  std::unique_ptr<td::ClientManager> client_manager_;
+};
+
+// Forwards to another transport and appends every request, response and
+// update with its time offset to a binary recording. Only the objects and
+// fields TaskApi reads are stored; anything else is kept as its type id.
+class RecordingTransport : public Transport {
+ public:
+  RecordingTransport(std::unique_ptr<Transport> inner, const std::string& path);
+  ~RecordingTransport();
+
+  std::int32_t create_client_id();
+  void send(std::int32_t client_id, std::uint64_t request_id,
+            td::td_api::object_ptr<td::td_api::Function> f);
+  td::ClientManager::Response receive(double timeout);
+
+ private:
+  std::unique_ptr<Transport> inner_;
+  std::ofstream out_;
+  std::mutex out_lock_;
+  std::chrono::steady_clock::time_point start_;
+
+  void write(std::uint8_t kind, std::int32_t client_id, std::uint64_t request_id,
+             const td::td_api::Object* object);
+};
+
+// Plays a recording back. Requests sent by the application are matched with
+// recorded requests (same parameters first, else same type, in order) and
+// the recorded responses are delivered under the live query ids. A record is
+// held back until the application has sent every request recorded before
+// it, so replay follows the application's causality; requests it never
+// sends are given up on after a few seconds. speed scales the recorded
+// delays; 0 delivers as fast as the application consumes.
+class ReplayTransport : public Transport {
+ public:
+  ReplayTransport(const std::string& path, double speed);
+
+  std::int32_t create_client_id();
+  void send(std::int32_t client_id, std::uint64_t request_id,
+            td::td_api::object_ptr<td::td_api::Function> f);
+  td::ClientManager::Response receive(double timeout);
+
+ private:
+  struct Record {
+    std::uint8_t kind;
+    std::int64_t time;  // microseconds from the start of the recording
+    std::int32_t client_id;
+    std::uint64_t request_id;
+    std::string payload;
+    bool matched{false};   // requests: sent by the application or given up
+    bool answered{false};  // requests: the recording has the response
+  };
+
+  std::vector<Record> records_;
+  std::size_t next_{0};
+  std::size_t clients_created_{0};
+  // earliest recorded request the application has not sent yet
+  std::size_t first_unmatched_{0};
+  std::size_t gate_index_{0};
+  std::chrono::steady_clock::time_point gate_since_;
+  double speed_;
+  std::chrono::steady_clock::time_point start_;
+  std::mutex lock_;
+  std::condition_variable sent_;
+  // indexes of recorded requests, by encoded request and by type
+  std::map<std::string, std::deque<std::size_t>> by_payload_;
+  std::map<std::int32_t, std::deque<std::size_t>> by_type_;
+  // recorded request id -> live request id
+  std::map<std::uint64_t, std::uint64_t> live_ids_;
+  std::deque<td::ClientManager::Response> immediate_;
+
+  std::size_t take(std::deque<std::size_t>& queue);
+};
+}  // namespace task_api
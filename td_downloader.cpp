@@ -1,8 +1,29 @@
-
 #include "inc/task_api.h"
 
-int main() {
-  task_api::TdMain main_task;
+#include <cstdlib>
+#include <string>
+
+// td_downloader [--record <file>] [--replay <file> [speed]]
+int main(int argc, char* argv[]) {
+  std::unique_ptr<task_api::Transport> transport =
+    std::make_unique<task_api::TdTransport>();
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "--record" && i + 1 < argc) {
+      transport = std::make_unique<task_api::RecordingTransport>(
+        std::move(transport), argv[++i]);
+    }
+    else if (arg == "--replay" && i + 1 < argc) {
+      std::string path(argv[++i]);
+      double speed = 1.0;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        speed = std::atof(argv[++i]);
+      }
+      transport = std::make_unique<task_api::ReplayTransport>(path, speed);
+    }
+  }
+
+  task_api::TdMain main_task(std::move(transport));
   main_task.run();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+// ends the test with the location of the first condition that fails
+#define CHECK(condition)                                                     \
+  do {                                                                       \
+    if (!(condition)) {                                                      \
+      std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition      \
+                << ") failed" << std::endl;                                  \
+      std::exit(1);                                                          \
+    }                                                                        \
+  } while (false)
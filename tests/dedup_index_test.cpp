@@ -0,0 +1,68 @@
+// DedupIndex round trip: committed keys survive a reopen and the growth of
+// the table, claims don't, and a damaged file is replaced by an empty one.
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "check.h"
+#include "inc/dedup_index.h"
+
+using namespace task_api;
+
+namespace {
+const char path[] = "./dedup_test.idx";
+// past 70% of the initial 65536 slots, so the table grows at least once
+const int keys = 60000;
+
+uint64_t key(int i) {
+  return DedupIndex::key("unique" + std::to_string(i), 1000 + i);
+}
+}  // namespace
+
+int main() {
+  std::remove(path);
+  CHECK(DedupIndex::key("", 1000) == 0);
+  CHECK(key(1) != key(2));
+  CHECK(DedupIndex::key("unique", 1) != DedupIndex::key("unique", 2));
+  {
+    DedupIndex index(path);
+    // files without a remote id are never deduplicated
+    CHECK(index.claim(0));
+    CHECK(index.claim(0));
+    for (int i = 0; i < keys; ++i) {
+      CHECK(index.claim(key(i)));
+      index.commit(key(i));
+    }
+    CHECK(index.size() == keys);
+    CHECK(!index.claim(key(0)));
+    CHECK(index.claim(key(keys)));
+    CHECK(!index.claim(key(keys)));
+    index.release(key(keys));
+    CHECK(index.claim(key(keys)));
+  }
+
+  {
+    DedupIndex index(path);
+    CHECK(index.size() == keys);
+    for (int i = 0; i < keys; ++i) {
+      CHECK(index.contains(key(i)));
+    }
+    // the claim above was never committed
+    CHECK(!index.contains(key(keys)));
+    CHECK(index.claim(key(keys)));
+  }
+
+  {
+    std::ofstream damaged(path, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+    damaged << "not an index";
+  }
+  {
+    DedupIndex index(path);
+    CHECK(index.size() == 0);
+    CHECK(!index.contains(key(0)));
+    index.commit(key(0));
+    CHECK(index.contains(key(0)));
+  }
+  std::remove(path);
+  return 0;
+}
@@ -0,0 +1,81 @@
+// ScanIndex round trip: ranges and files survive a reopen, a torn last
+// line is dropped and compaction keeps the contents.
+#include <cstdio>
+#include <fstream>
+
+#include "check.h"
+#include "inc/scan_index.h"
+
+using namespace task_api;
+
+namespace {
+const int64_t chatId = -100123;
+const char path[] = "./-100123-scanned.idx";
+
+void check_contents(ScanIndex& index) {
+  int64_t lo = 0, hi = 0;
+  CHECK(index.covered(25, lo, hi));
+  CHECK(lo == 10 && hi == 30);
+  CHECK(index.covered(50, lo, hi));
+  CHECK(lo == 50 && hi == 60);
+  CHECK(!index.covered(40, lo, hi));
+  CHECK(index.file_done(7));
+  CHECK(!index.file_done(8));
+}
+}  // namespace
+
+int main() {
+  std::remove(path);
+  {
+    auto index = ScanIndex::open(chatId, ".");
+    index->add_range(10, 20);
+    // touching ranges merge
+    index->add_range(21, 30);
+    index->add_range(50, 60);
+    index->add_file(7);
+    CHECK(index->claim_file(8));
+    CHECK(!index->claim_file(8));
+    // done files can't be claimed
+    CHECK(!index->claim_file(7));
+    check_contents(*index);
+    // one instance per chat and directory
+    CHECK(ScanIndex::open(chatId, ".") == index);
+  }
+
+  {
+    auto index = ScanIndex::open(chatId, ".");
+    check_contents(*index);
+    // claims are not persisted
+    CHECK(index->claim_file(8));
+  }
+
+  {
+    std::ofstream torn(path, std::ios_base::out | std::ios_base::app);
+    torn << "r 100 200";
+  }
+  {
+    auto index = ScanIndex::open(chatId, ".");
+    int64_t lo = 0, hi = 0;
+    CHECK(!index->covered(150, lo, hi));
+    check_contents(*index);
+    // enough journal records to compact it
+    for (int i = 0; i < 10000; ++i) {
+      index->add_range(10, 20);
+    }
+    check_contents(*index);
+  }
+
+  {
+    auto index = ScanIndex::open(chatId, ".");
+    check_contents(*index);
+  }
+  std::ifstream compacted(path);
+  int lines = 0;
+  for (std::string line; std::getline(compacted, line);) {
+    ++lines;
+  }
+  // reopening rewrote the journal as its merged contents
+  CHECK(lines == 3);
+  std::remove(path);
+  return 0;
+}
@@ -0,0 +1,134 @@
+// SearchIndex round trip: documents survive a reopen through the snapshot
+// and through the journal alone, a torn last journal record is dropped and
+// documents added after that are still journaled.
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "check.h"
+#include "inc/search_index.h"
+
+using namespace task_api;
+
+namespace {
+const char snapshot[] = "./search_test.idx";
+const char journal[] = "./search_test.log";
+const char crashSnapshot[] = "./search_test_crash.idx";
+const char crashJournal[] = "./search_test_crash.log";
+
+void remove_files() {
+  for (const char* path : {snapshot, journal, crashSnapshot, crashJournal}) {
+    std::remove(path);
+  }
+}
+
+// the files as a crash would leave them while index is open
+void copy_as_crashed() {
+  auto overwrite = std::filesystem::copy_options::overwrite_existing;
+  std::remove(crashSnapshot);
+  if (std::filesystem::exists(snapshot)) {
+    std::filesystem::copy_file(snapshot, crashSnapshot, overwrite);
+  }
+  std::filesystem::copy_file(journal, crashJournal, overwrite);
+}
+
+bool found(SearchIndex& index, const std::string& query, int64_t msg_id) {
+  for (auto& hit : index.search(query, 100)) {
+    if (hit.msg_id == msg_id) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace
+
+int main() {
+  remove_files();
+  {
+    SearchIndex index(snapshot, journal);
+    CHECK(index.documents() == 0);
+    index.add(1, 10, "Holiday photos from Lisbon");
+    index.add(1, 11, "lisbon video, part 2");
+    index.add(2, 20, "上海 travel");
+    // a message is indexed once
+    index.add(1, 10, "something else");
+    CHECK(index.documents() == 3);
+
+    auto hits = index.search("LISBON", 10);
+    CHECK(hits.size() == 2);
+    // most recently indexed first
+    CHECK(hits[0].msg_id == 11 && hits[1].msg_id == 10);
+    CHECK(index.search("lisbon photos", 10).size() == 1);
+    CHECK(index.search("lisbon", 10, 2).empty());
+    CHECK(found(index, "海", 20));
+    CHECK(index.search("madrid", 10).empty());
+    CHECK(index.search("lisbon", 1).size() == 1);
+
+    // the journal alone restores the documents
+    copy_as_crashed();
+    SearchIndex crashed(crashSnapshot, crashJournal);
+    CHECK(crashed.documents() == 3);
+    CHECK(found(crashed, "holiday", 10));
+  }
+
+  // written to the snapshot on exit
+  {
+    SearchIndex index(snapshot, journal);
+    CHECK(index.documents() == 3);
+    CHECK(found(index, "holiday lisbon", 10));
+    CHECK(found(index, "上海", 20));
+    index.add(3, 30, "after the snapshot");
+    CHECK(index.documents() == 4);
+  }
+
+  // a torn record at the end of the journal
+  {
+    SearchIndex index(snapshot, journal);
+    index.add(4, 40, "journaled before the tear");
+  }
+  {
+    SearchIndex index(snapshot, journal);
+    index.add(5, 50, "journaled record");
+    copy_as_crashed();
+  }
+  {
+    std::ofstream torn(crashJournal, std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+    // chat id 6, message id 60, a text of 100 bytes cut at 3
+    torn << '\x0c' << '\x78' << '\x64' << "cut";
+  }
+  std::filesystem::copy_file(crashSnapshot, snapshot, std::filesystem::copy_options::overwrite_existing);
+  std::filesystem::copy_file(crashJournal, journal, std::filesystem::copy_options::overwrite_existing);
+  {
+    SearchIndex index(snapshot, journal);
+    CHECK(index.documents() == 6);
+    CHECK(found(index, "journaled record", 50));
+    CHECK(index.search("cut", 10).empty());
+    // still journaled after the torn record was dropped
+    index.add(7, 70, "added after recovery");
+    copy_as_crashed();
+    SearchIndex crashed(crashSnapshot, crashJournal);
+    CHECK(crashed.documents() == 7);
+    CHECK(found(crashed, "recovery", 70));
+  }
+  {
+    SearchIndex index(snapshot, journal);
+    CHECK(index.documents() == 7);
+    CHECK(found(index, "recovery", 70));
+  }
+
+  // a damaged snapshot is dropped, the journal is still replayed
+  {
+    SearchIndex index(snapshot, journal);
+    index.add(8, 80, "only in the journal");
+    copy_as_crashed();
+  }
+  std::filesystem::resize_file(crashSnapshot, std::filesystem::file_size(crashSnapshot) / 2);
+  {
+    SearchIndex index(crashSnapshot, crashJournal);
+    CHECK(found(index, "journal", 80));
+    CHECK(!found(index, "recovery", 70));
+  }
+  remove_files();
+  return 0;
+}